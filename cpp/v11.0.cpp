@@ -1,17 +1,22 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <HTTPClient.h>
 #include <WiFiClientSecure.h> 
 #include <PubSubClient.h> 
-#include <DHT.h>
 #include <time.h>
 #include "soc/soc.h"
 #include "soc/rtc_cntl_reg.h"
+#include "soc/gpio_struct.h"
 #include <Preferences.h> 
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "driver/gpio.h"
+#include "esp_cpu.h"
 
 // ==========================================
 //  ESP32 智慧農場 v11.0 (RS485 Upgrade)
 //  功能：RS485土壤感測 + 斷電記憶 + 接觸器回授保險
+//  架構：控制任務獨佔核心 1，感測/網路任務在核心 0 (FreeRTOS)
 // ==========================================
 
 const char* ssid = "EVDS";
@@ -29,9 +34,23 @@ const char* discord_webhook = "https://discord.com/";
 // MQTT Topics
 const char* topic_data = "farm/monitor";    
 const char* topic_control = "farm/control"; 
+const char* topic_metrics = "farm/metrics"; // [新增] 系統效能指標
+const char* topic_probes = "farm/probes";   // [新增] 各土壤探頭數值與統計 (farm/probes/<地址>)
+const char* topic_relays = "farm/relays";   // [新增] RS485 繼電器板狀態 (farm/relays/<地址>)
+const char* topic_history = "farm/history"; // [新增] 歷史資料查詢結果 (MQTT 指令 HISTORY)
+const char* topic_backlog = "farm/monitor/backlog"; // [新增] 斷線期間的補送資料 (格式見 flashLogReplay)
+const char* topic_health = "farm/health";   // [新增] 記憶體與堆疊健康狀態
+const char* topic_data_bin = "farm/monitor/bin"; // [新增] 二進位精簡遙測 (與 farm/monitor 同內容，格式見 packTelemetry)
+const char* topic_stages = "farm/metrics/stages"; // [新增] 各階段耗時直方圖 (MQTT 指令 STAGES)
+const char* topic_sim = "farm/sim";         // [新增] 加速模擬結果 (MQTT 指令 SIM)
+const bool publishBinary = true;            // 不需要時關掉，只送 JSON
 
 // 其他設定
 String writeApiKey = " "; 
+// [新增] ThingSpeak 批次上傳 (bulk_update)；host/port 可改成本地測試伺服器，例如 "192.168.0.50", 8080
+const char* thingspeakHost = "api.thingspeak.com";
+const uint16_t thingspeakPort = 80;
+const char* thingspeakChannel = " ";        // 頻道 ID (bulk_update 網址需要)
 const int pumpPin = 17;    
 const int fertPin = 5;    
 // const int soilPin = 34; // [移除] 舊類比腳位
@@ -41,22 +60,103 @@ const int olFertPin = 19;
 // [新增] RS485 定義
 #define RX_PIN 26      // 連接 MAX485 RO
 #define TX_PIN 27      // 連接 MAX485 DI
-#define DE_RE_PIN 14   // 連接 MAX485 DE & RE
+#define DE_RE_PIN 14   // 連接 MAX485 DE & RE (由 UART2 的 RTS 硬體自動控制方向)
 HardwareSerial rs485Serial(2); // 使用 UART2
 
 // RS485 查詢指令 (Modbus RTU)
-// 查詢地址01, 功能碼03, 起始暫存器0000, 讀取長度4個 (水分,溫度,EC,PH或鹽分)
-// 請依照你的感測器說明書確認查詢碼，以下為通用型 NPK/5合1 感測器指令
-const byte soilQuery[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x04, 0x44, 0x09}; 
+// [修改] 改為每種探頭型號一張暫存器對照表，查詢碼依對照表與探頭地址自動產生
+// 請依照你的感測器說明書確認暫存器位址與倍率
+enum SoilField : uint8_t {
+  SF_HUM, SF_TEMP, SF_EC, SF_SALINITY, SF_PH, SF_N, SF_P, SF_K,
+  SOIL_FIELD_COUNT
+};
+
+// scale = 原始值乘上的倍率；isSigned = 16 位元有號數 (例如零下的溫度)
+struct RegisterDesc {
+  SoilField field;
+  const char* name;
+  uint16_t reg;
+  float scale;
+  bool isSigned;
+};
+
+// maxGap：兩段暫存器之間隔著幾個以內的未定義位址時仍合併成同一個請求。
+// 多數探頭讀到未定義位址會回例外 02 (illegal data address)，所以預設 0 = 只合併相鄰的；
+// 說明書確認未定義位址會回 0 的型號才調大 (多開一筆交易約等於多讀 16 個暫存器)
+struct ProbeModel {
+  const char* name;
+  const RegisterDesc* regs;
+  uint8_t regCount;
+  uint8_t maxGap;
+};
+
+// 通用型 5合1 (原 v11.0 解析方式：溫度, 水分, EC, 鹽分)
+const RegisterDesc soil5in1Regs[] = {
+  {SF_TEMP,     "soil_temp", 0x0000, 0.01f, true},
+  {SF_HUM,      "soil_hum",  0x0001, 0.01f, false},
+  {SF_EC,       "ec",        0x0002, 1.0f,  false},
+  {SF_SALINITY, "salinity",  0x0003, 1.0f,  false}, // 如果是 PH 則倍率改 0.1
+};
+// 7合1 NPK (常見 JXBS-3001 系列)
+const RegisterDesc soil7in1NpkRegs[] = {
+  {SF_PH,   "ph",        0x0006, 0.01f, false},
+  {SF_HUM,  "soil_hum",  0x0012, 0.1f,  false},
+  {SF_TEMP, "soil_temp", 0x0013, 0.1f,  true},
+  {SF_EC,   "ec",        0x0015, 1.0f,  false},
+  {SF_N,    "n",         0x001E, 1.0f,  false},
+  {SF_P,    "p",         0x001F, 1.0f,  false},
+  {SF_K,    "k",         0x0020, 1.0f,  false},
+};
+const ProbeModel soil5in1 = {"5in1", soil5in1Regs, sizeof(soil5in1Regs) / sizeof(soil5in1Regs[0]), 0};
+const ProbeModel soil7in1Npk = {"7in1_npk", soil7in1NpkRegs, sizeof(soil7in1NpkRegs) / sizeof(soil7in1NpkRegs[0]), 0};
+
+// 相鄰暫存器合併成同一個 0x03 請求 (間隔見 ProbeModel::maxGap)，每個探頭最多幾個請求
+#define MAX_READ_BLOCKS 8
+
+// [新增] RS485 多探頭設定 (同一條 MAX485 匯流排，最多 32 個)
+// priority 數字越小越優先；control=true 的探頭參與自動灌溉判斷 (取平均)
+struct SoilProbeConfig {
+  uint8_t addr;
+  uint8_t priority;
+  uint16_t periodMs;
+  bool control;
+  const ProbeModel* model;
+};
+const SoilProbeConfig soilProbeConfig[] = {
+  {0x01, 0, 2000, true, &soil5in1},
+  // {0x02, 0, 2000, true, &soil5in1},
+  // {0x03, 1, 10000, false, &soil7in1Npk},
+};
+#define MAX_SOIL_PROBES 32
+const uint32_t soilReplyTimeoutMs = 200;    // 單一探頭回應逾時 (多探頭時 500ms 太長)
+const uint8_t soilOfflineAfter = 3;         // 連續失敗幾次視為離線
+const uint32_t soilOfflineRetryMs = 30000;  // 離線探頭降頻重試，不佔用匯流排預算
+const uint32_t soilSweepBudgetMs = 2500;    // 所有在線探頭各輪詢一次的時間預算 (9600 baud 下 32 顆約 1.5s)
+
+// [新增] RS485 繼電器板 (Modbus 線圈輸出，擴充閥門，不佔 GPIO)
+// 與土壤探頭共用同一條匯流排；閥門編號依序排在各板線圈之後 (第一塊板 0~7，第二塊 8~15 ...)
+struct RelayBoardConfig {
+  uint8_t addr;
+  uint8_t coils;            // 最多 32
+};
+const RelayBoardConfig relayBoardConfig[] = {
+  // {0x10, 8},
+  // {0x11, 16},
+  {0, 0},                   // 空白項 (coils = 0 的項目略過)；C++ 不允許空陣列，沒有繼電器板時保留這一筆
+};
+#define MAX_RELAY_BOARDS 4
+const uint32_t relayVerifyMs = 5000;        // 定期讀回線圈狀態
+const uint32_t relayRetryMs = 1000;         // 通訊失敗後的重試間隔
 
 // 電磁接觸器回授
 const int fbPumpPin = 12;   
 const int fbFertPin = 13;   
 
 #define DHTPIN 4
-#define DHTTYPE DHT11
+#define DHTTYPE 11          // [修改] 11 = DHT11, 22 = DHT22 (不再使用 DHT 函式庫)
+const uint8_t dhtFailLimit = 3;             // 連續失敗幾次才視為故障，期間沿用上一筆數值
 
-const int soilLow = 20;
+const int soilLow = 20;     // [修改] 預設值；執行中可由 MQTT SET 指令調整 (存在 NVS)
 const int soilHigh = 80;
 const int fertHour = 8;
 const int fertDuration = 10;
@@ -68,7 +168,58 @@ const char* ntpServer = "pool.ntp.org";
 const long  gmtOffset_sec = 28800; 
 const int   daylightOffset_sec = 0;
 
-DHT dht(DHTPIN, DHTTYPE);
+// --- [新增] FreeRTOS 任務配置 ---
+// 核心 1 只跑控制任務，WiFi/TLS/RS485/DHT 全部放在核心 0，
+// 網路再慢也不會拖到過載保護與水泵切斷。
+#define CONTROL_CORE 1
+#define IO_CORE      0
+const uint32_t controlPeriodMs = 10;     // 控制週期 (原 loop 的 delay(10))
+const uint32_t controlBudgetUs = 2000;   // 單次控制運算上限，超過記為 overrun
+const uint32_t sensorPeriodMs  = 2000;   // 感測週期 (原本每 2 秒讀一次 RS485)
+const uint32_t sensorStaleMs   = 5 * sensorPeriodMs; // [新增] 快照超過這麼久沒更新視為感測器故障 (感測任務卡住)
+const long metricsInterval = 10000;      // 效能指標發佈間隔
+
+// --- [新增] 狀態保存 (NVS 延遲合併寫入) ---
+const uint32_t persistDelayMs = 5000;    // 狀態改變後等這麼久才寫入，期間的變更合併成一次
+
+// --- [新增] 歷史資料環形緩衝 (大小在編譯期決定，開機時一次配置) ---
+#define HISTORY_RAW_SLOTS 600    // 1 秒 x 600 = 最近 10 分鐘
+#define HISTORY_MIN_SLOTS 240    // 1 分鐘 x 240 = 最近 4 小時 (最小/平均/最大)
+#define HISTORY_QTR_SLOTS 192    // 15 分鐘 x 192 = 最近 2 天
+const uint16_t historyRowsPerMsg = 20;   // 查詢結果每則 MQTT 訊息的筆數
+
+// --- [新增] 斷線暫存 (flash 分割區環形日誌) ---
+// 使用名為 "tlog" 的 data 分割區
+// [修改] 沒有 tlog 時借用預設分割表的 "spiffs" 要自行開啟：會抹除 spiffs 的內容，
+//        確定沒有其他韌體 / 檔案系統把資料放在那裡才設成 1 (或編譯時 -DFLASH_LOG_USE_SPIFFS=1)
+#ifndef FLASH_LOG_USE_SPIFFS
+#define FLASH_LOG_USE_SPIFFS 0
+#endif
+const uint32_t flashLogIntervalMs = 5000;   // 斷線時每 5 秒記一筆 (1.5MB 約可存 65 小時)
+const uint32_t flashLogFlushMs = 30000;     // RAM 暫存最多放這麼久就寫入
+const uint32_t flashReplayGapMs = 250;      // 補送批次間隔，避免佔滿網路任務
+#define FLASH_LOG_STAGE 8                   // RAM 暫存筆數，滿了一次寫入
+#define FLASH_REPLAY_BATCH 32               // 每則補送訊息的筆數
+
+// --- [新增] 連線管理 (WiFi 事件驅動 + 指數退避) ---
+const uint32_t connBackoffBaseMs = 2000;     // 第一次重試間隔，之後加倍
+const uint32_t connBackoffMaxMs = 60000;     // 最長 60s，每次再加減 25% 隨機抖動
+const uint32_t wifiStallMs = 30000;          // 嘗試後這麼久都沒有任何事件，視為卡住再試一次
+
+// --- [新增] 健康監控 (取代每天 03:00 無條件重開機) ---
+const uint32_t healthCheckMs = 10000;        // 檢查與發佈間隔
+const uint32_t healthMinFreeHeap = 24000;    // 可用 heap 低於此值
+const uint32_t healthMinLargestBlock = 16000;// 最大連續區塊低於此值 (TLS 握手約需 16KB 連續空間)
+const uint32_t healthMinStackBytes = 384;    // 任一任務堆疊剩餘低於此值
+const uint8_t healthTripChecks = 6;          // 連續幾次不合格才重開機 (6 x 10s = 1 分鐘)
+const uint32_t healthRestartGraceMs = 300000;// 等水泵/施肥停止的最長時間，超過就直接重開
+
+// --- [新增] 警報外寄匣 (Discord) ---
+#define ALERT_OUTBOX_SIZE 16                 // 預先配置的槽數，滿了就丟棄新警報並計數
+const uint8_t alertMaxAttempts = 6;          // 單則警報最多嘗試次數
+const uint32_t alertBackoffBaseMs = 1000;    // 重試退避：1s, 2s, 4s ...
+const uint32_t alertBackoffMaxMs = 60000;    //           最長 60s
+
 WiFiClient espClient;
 PubSubClient client(espClient); 
 Preferences prefs; 
@@ -80,362 +231,3855 @@ float soil_temp = 0.0;
 int soil_ec = 0;
 int soil_salinity = 0; // 或 PH，視感測器而定
 
-bool autoMode = true;   
-bool pumpSoftAlarm = false; 
-unsigned long pumpStartTime = 0;
-bool pumpRunning = false;
-unsigned long fertStartTime = 0;
-bool fertRunning = false;
-bool fertJobDoneToday = false;
-
-// --- 狀態追蹤 ---
-bool lastPumpOverloadState = false;
-bool lastFertOverloadState = false;
-bool lastSensorErrorState = false;
-bool lastFbPumpError = false;
-bool lastFbFertError = false;
-
-unsigned long stateChangeTime = 0;
+// [修改] 水泵、施肥機、模式與警報狀態移到 FarmController (見下方)
 
 unsigned long lastUploadTime = 0;
 const long uploadInterval = 60000; 
+const unsigned long thingspeakBatchMs = 15 * 60000UL;  // [新增] 每 15 分鐘送一批 (一小時 4 個請求，原本 60 個)
+const unsigned long thingspeakRetryMs = 60000;         // 失敗後的重試間隔
+#define TS_BUFFER_SLOTS 64                             // 暫存筆數，滿了丟最舊的
 unsigned long lastMqttTime = 0;
 const long mqttInterval = 1000;    
 
+// [新增] 變化驅動發佈：任一欄位超過死區或狀態位元改變就立即送出，
+// 否則只送心跳。mqttInterval 改為「舊制應送的週期」，用來統計省下的筆數
+struct TelemetryDeadband {
+  float airTemp;
+  float airHum;
+  float soilHum;
+  float soilTemp;
+  int ec;
+  int salinity;
+};
+const TelemetryDeadband telemetryDeadband = { 0.3, 1.0, 0.5, 0.3, 20, 10 };
+const long telemetryHeartbeatMs = 30000;  // 沒變化時的心跳間隔
+const long telemetryMinGapMs = 200;       // 數值抖動時的最小發送間隔 (狀態改變不受限)
+unsigned long lastMetricsTime = 0;
+unsigned long lastTelemetrySentTime = 0;
+bool telemetrySentOnce = false;
+
 // ==========================================
-//  Discord 發送函式
+//  [新增] 任務間傳遞的資料結構
 // ==========================================
-void sendDiscord(String content) {
-  if (WiFi.status() == WL_CONNECTED) {
-    WiFiClientSecure secureClient;
-    secureClient.setInsecure(); 
-    HTTPClient https;
-    if (https.begin(secureClient, discord_webhook)) {
-      https.addHeader("Content-Type", "application/json");
-      String payload = "{\"content\":\"" + content + "\"}";
-      https.POST(payload);
-      https.end();
-    }
-  }
-}
+// MQTT 指令 (網路任務 -> 控制任務)
+enum FarmCmdType : uint8_t {
+  CMD_STOP, CMD_AUTO_ON, CMD_AUTO_OFF,
+  CMD_PUMP_ON, CMD_PUMP_OFF, CMD_FERT_ON, CMD_FERT_OFF,
+  CMD_VALVE_ON, CMD_VALVE_OFF,
+  CMD_PUMP_RUN, CMD_SET_SOIL, CMD_SIM
+};
+struct FarmCmd {
+  FarmCmdType type;
+  uint16_t arg;             // 閥門編號 / 澆水秒數 / 土壤下限 / 模擬天數
+  uint16_t arg2;            // 土壤上限 / 模擬參數 (低位元組 wet、高位元組 trip_min)
+};
+
+// 感測快照 (感測任務 -> 控制任務，長度 1 的信箱，永遠只留最新一筆)
+struct SensorSnapshot {
+  float airTemp;
+  float airHum;
+  float soilHum;
+  float soilTemp;
+  int ec;
+  int salinity;
+  bool dhtOk;
+  bool rs485Ok;
+  uint32_t takenMs;         // [新增] 感測任務發佈的時間 (millis)，控制任務據此判斷是否過舊
+};
+
+// 遙測快照 (控制任務 -> 網路任務)
+struct FarmTelemetry {
+  float airTemp;
+  float airHum;
+  float soilHum;
+  float soilTemp;
+  int ec;
+  int salinity;
+  int status;
+};
+
+// 警報訊息 (任何任務 -> 警報任務)
+struct AlertMsg {
+  char text[160];
+  uint8_t attempts;
+};
+
+// [新增] 遙測發送統計 (只在網路任務存取)
+struct TelemetryStats {
+  uint32_t sent;
+  uint32_t suppressed;    // 舊制每秒都會送、這次省下的筆數
+  uint32_t heartbeats;
+  uint32_t statusChanges; // 因狀態位元改變而立即送出
+};
+
+// 警報外寄匣：固定大小的環形緩衝，入列 O(1)，不配置記憶體、不等待
+struct AlertOutbox {
+  AlertMsg slots[ALERT_OUTBOX_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint32_t sent;
+  uint32_t retries;
+  uint32_t failed;        // 重試用盡而放棄
+  uint32_t dropped;       // 外寄匣滿而丟棄 (累計)
+  uint32_t droppedUnreported;
+};
+
+// 控制週期統計：由控制任務寫入，網路任務讀出後歸零
+struct ControlStats {
+  uint32_t cycles;
+  uint32_t overruns;
+  uint32_t maxExecUs;
+  uint32_t maxPeriodUs;
+  uint64_t sumExecUs;
+};
+
+QueueHandle_t cmdQueue;
+QueueHandle_t sensorMailbox;
+QueueHandle_t telemetryMailbox;
+FarmTelemetry lastSentTelemetry;     // [新增] 上一次送出的遙測，作為死區比較基準
+TelemetryStats telemetryStats = {};
+TaskHandle_t controlTaskHandle = NULL;
+TaskHandle_t sensorTaskHandle = NULL;
+TaskHandle_t netTaskHandle = NULL;
+TaskHandle_t alertTaskHandle = NULL;
+TaskHandle_t simTaskHandle = NULL;
+
+ControlStats ctlStats = {};
+portMUX_TYPE ctlStatsMux = portMUX_INITIALIZER_UNLOCKED;
+
+AlertOutbox outbox = {};
+portMUX_TYPE outboxMux = portMUX_INITIALIZER_UNLOCKED;
 
 // ==========================================
-//  [新增] RS485 土壤數據讀取函式
+//  [新增] 灌溉 / 施肥控制器 (純邏輯狀態機)
+//  輸入一份快照與時間，輸出線圈狀態、狀態位元與事件。
+//  不配置記憶體、不碰腳位 / 網路 / NVS，每次 tick() 的工作量固定；
+//  讀腳位、發警報、寫 NVS 都留給 controlCycle()。
+//  指令 (command) 只改狀態，產生的事件併入下一次 tick() 的輸出。
 // ==========================================
-bool readSoilSensor() {
-  digitalWrite(DE_RE_PIN, HIGH); // 切換為傳送模式 (TX)
-  delay(10);
-  rs485Serial.write(soilQuery, sizeof(soilQuery));
-  rs485Serial.flush(); // 等待傳送完成
-  digitalWrite(DE_RE_PIN, LOW);  // 切換為接收模式 (RX)
-  
-  // 等待回應 (最多等待 500ms)
-  unsigned long timeout = millis();
-  while (rs485Serial.available() < 13) { // 預期收到 13 Bytes (地址+功能+字節數+數據*4+CRC)
-    if (millis() - timeout > 500) {
-      return false; // 超時
+struct ControlConfig {
+  int16_t soilLow;
+  int16_t soilHigh;
+  uint8_t fertHour;
+  uint16_t fertDurationMin;
+  uint16_t pumpMaxRunMin;
+  uint16_t feedbackSettleMs;  // 切換後等接觸器動作完成才比對回授
+};
+
+struct ControlInput {
+  uint32_t nowMs;
+  bool timeSynced;
+  uint8_t hour;
+  uint8_t minute;
+  int16_t yday;
+  bool haveSensor;          // 已有感測快照
+  bool rs485Ok;
+  float soilHum;            // 最後一筆有效的土壤濕度
+  bool pumpOverload;        // 積熱電驛跳脫
+  bool fertOverload;
+  bool pumpFeedback;        // 接觸器實際吸合
+  bool fertFeedback;
+};
+
+// 依同一週期內原本的警報順序排列 (controlCycle 由低位元往高位元送出)
+enum ControlEvent : uint8_t {
+  EV_MANUAL, EV_STOP, EV_AUTO_ON, EV_AUTO_OFF, EV_SOIL_SET,
+  EV_SENSOR_FAULT, EV_PUMP_OVERLOAD, EV_FERT_OVERLOAD,
+  EV_PUMP_FB_FAIL, EV_PUMP_FB_RUNAWAY, EV_FERT_FB_FAIL, EV_FERT_FB_RUNAWAY,
+  EV_FERT_START, EV_FERT_DONE, EV_PUMP_TIMEOUT, EV_PUMP_RUN_DONE,
+  EV_COUNT
+};
+
+struct ControlOutput {
+  bool pump;                // 水泵線圈
+  bool fert;                // 施肥機線圈
+  uint16_t status;          // 遙測狀態位元
+  uint32_t events;          // 1 << ControlEvent
+};
+
+class FarmController {
+ public:
+  explicit FarmController(const ControlConfig& cfg) : cfg(cfg) {}
+
+  // 開機時由 NVS 讀回的部分
+  void restore(bool autoModeOn, bool lockedOut, int16_t fertYday, uint32_t pumpMinutes, uint32_t fertMinutes, uint32_t nowMs) {
+    autoOn = autoModeOn;
+    softAlarm = lockedOut;
+    doneYday = fertYday;
+    pumpMin = pumpMinutes;
+    fertMin = fertMinutes;
+    stateChangeMs = nowMs;
+  }
+
+  void setThresholds(int16_t low, int16_t high) { cfg.soilLow = low; cfg.soilHigh = high; }
+
+  void command(const FarmCmd& cmd, uint32_t now) {
+    bool isManual = (cmd.type >= CMD_PUMP_ON && cmd.type <= CMD_FERT_OFF) || cmd.type == CMD_PUMP_RUN;
+    if (isManual && autoOn) {
+      autoOn = false;
+      events |= 1UL << EV_MANUAL;
+    }
+
+    switch (cmd.type) {
+      case CMD_STOP:
+        autoOn = false;
+        pump = fert = false;
+        stateChangeMs = now;
+        events |= 1UL << EV_STOP;
+        break;
+      case CMD_AUTO_ON:
+        autoOn = true;
+        softAlarm = false; // 重新啟用自動模式即解除超時鎖定
+        events |= 1UL << EV_AUTO_ON;
+        break;
+      case CMD_AUTO_OFF:
+        autoOn = false;
+        events |= 1UL << EV_AUTO_OFF;
+        break;
+      case CMD_PUMP_ON:
+      case CMD_PUMP_RUN:
+        if (lastPumpOverload) break; // 上一週期讀到的積熱電驛狀態
+        fert = false;
+        pump = true;
+        pumpStartMs = now;
+        pumpRunMs = cmd.type == CMD_PUMP_RUN ? (uint32_t)cmd.arg * 1000 : 0;
+        stateChangeMs = now;
+        break;
+      case CMD_PUMP_OFF:
+        pump = false;
+        stateChangeMs = now;
+        break;
+      case CMD_FERT_ON:
+        if (lastFertOverload) break;
+        pump = false;
+        fert = true;
+        fertStartMs = now;
+        stateChangeMs = now;
+        break;
+      case CMD_FERT_OFF:
+        fert = false;
+        stateChangeMs = now;
+        break;
+      case CMD_SET_SOIL:
+        setThresholds(cmd.arg, cmd.arg2);
+        events |= 1UL << EV_SOIL_SET;
+        break;
+      default:
+        break;                // 閥門 / 模擬指令不屬於這裡
+    }
+  }
+
+  ControlOutput tick(const ControlInput& in) {
+    uint32_t now = in.nowMs;
+
+    // 感測器故障 (這裡把 soilHum 視為主要控制依據)
+    // 空氣溫濕度 (DHT) 不參與灌溉判斷，讀不到也照常自動澆水 (與原版相同)
+    bool sensorError = !in.haveSensor || !in.rs485Ok || in.soilHum == 0.0f;
+    if (sensorError && !lastSensorError && in.haveSensor) events |= 1UL << EV_SENSOR_FAULT;
+    lastSensorError = sensorError;
+
+    // 過載保護
+    if (in.pumpOverload && !lastPumpOverload) { pump = false; stateChangeMs = now; events |= 1UL << EV_PUMP_OVERLOAD; }
+    if (in.fertOverload && !lastFertOverload) { fert = false; stateChangeMs = now; events |= 1UL << EV_FERT_OVERLOAD; }
+    lastPumpOverload = in.pumpOverload;
+    lastFertOverload = in.fertOverload;
+    if (in.pumpOverload && pump) { pump = false; stateChangeMs = now; }
+    if (in.fertOverload && fert) { fert = false; stateChangeMs = now; }
+
+    // 接觸器回授
+    if (now - stateChangeMs >= cfg.feedbackSettleMs) {
+      if (pump != in.pumpFeedback) {
+        if (!fbPumpError) events |= 1UL << (pump ? EV_PUMP_FB_FAIL : EV_PUMP_FB_RUNAWAY);
+        fbPumpError = true;
+      } else {
+        fbPumpError = false;
+      }
+      if (fert != in.fertFeedback) {
+        if (!fbFertError) events |= 1UL << (fert ? EV_FERT_FB_FAIL : EV_FERT_FB_RUNAWAY);
+        fbFertError = true;
+      } else {
+        fbFertError = false;
+      }
+    }
+
+    // 自動化邏輯
+    if (autoOn) {
+      if (in.timeSynced && !in.fertOverload) {
+        if (doneYday == in.yday) fertDoneToday = true; // 今天施肥後重開機不重複施肥
+        if (in.hour == cfg.fertHour && in.minute == 0 && !fert && !fertDoneToday) {
+          pump = false;
+          fert = true;
+          fertStartMs = now;
+          fertDoneToday = true;
+          doneYday = in.yday;
+          stateChangeMs = now;
+          events |= 1UL << EV_FERT_START;
+        }
+        if (fert && now - fertStartMs >= cfg.fertDurationMin * 60000UL) {
+          fert = false;
+          stateChangeMs = now;
+          events |= 1UL << EV_FERT_DONE;
+        }
+        if (in.hour == 0 && in.minute == 0) fertDoneToday = false;
+      }
+
+      if (!softAlarm && !in.pumpOverload && !sensorError) {
+        if (in.soilHum < cfg.soilLow && !pump && !fert) {
+          pump = true;
+          pumpStartMs = now;
+          pumpRunMs = 0;
+          stateChangeMs = now;
+        } else if (in.soilHum > cfg.soilHigh && pump) {
+          pump = false;
+          stateChangeMs = now;
+        }
+      } else if ((sensorError || in.pumpOverload) && pump) {
+        pump = false;
+        stateChangeMs = now;
+      }
+    }
+
+    // [修改] PUMP_RUN 定時澆水到時自動關閉；先於超時檢查，sec 剛好等於上限時算正常結束
+    if (pump && pumpRunMs && now - pumpStartMs >= pumpRunMs) {
+      pump = false;
+      pumpRunMs = 0;
+      stateChangeMs = now;
+      events |= 1UL << EV_PUMP_RUN_DONE;
     }
-    delay(10);
+
+    if (pump && (now - pumpStartMs) / 60000 >= cfg.pumpMaxRunMin) {
+      pump = false;
+      softAlarm = true;
+      stateChangeMs = now;
+      events |= 1UL << EV_PUMP_TIMEOUT;
+    }
+
+    // 累計運轉時間 (每滿一分鐘才更新保存值，避免持續寫入)
+    uint32_t dt = ticked ? now - lastTickMs : 0;
+    ticked = true;
+    lastTickMs = now;
+    if (pump) pumpAccumMs += dt;
+    if (fert) fertAccumMs += dt;
+    if (pumpAccumMs >= 60000) { pumpAccumMs -= 60000; pumpMin++; }
+    if (fertAccumMs >= 60000) { fertAccumMs -= 60000; fertMin++; }
+
+    ControlOutput out;
+    out.pump = pump;
+    out.fert = fert;
+    out.status = (pump ? 1 : 0) | (fert ? 2 : 0) | (softAlarm ? 4 : 0) | (sensorError ? 8 : 0) |
+                 (autoOn ? 16 : 0) | (in.pumpOverload ? 32 : 0) | (in.fertOverload ? 64 : 0) |
+                 (fbPumpError ? 128 : 0) | (fbFertError ? 256 : 0);
+    out.events = events;
+    events = 0;
+    return out;
   }
 
-  byte buf[13];
-  rs485Serial.readBytes(buf, 13);
+  const ControlConfig& config() const { return cfg; }
+  bool autoMode() const { return autoOn; }
+  bool pumpSoftAlarm() const { return softAlarm; }
+  bool pumpRunning() const { return pump; }
+  bool fertRunning() const { return fert; }
+  bool idle() const { return !pump && !fert; }
+  int16_t fertDoneYday() const { return doneYday; }
+  uint32_t pumpRunMin() const { return pumpMin; }
+  uint32_t fertRunMin() const { return fertMin; }
 
-  // 簡單檢查回應頭 (地址01, 功能03, 字節數08)
-  if (buf[0] == 0x01 && buf[1] == 0x03 && buf[2] == 0x08) {
-    // 解析數據 (依照通用協議: Hum, Temp, EC, Salinity/PH)
-    // 數值通常為 Big Endian，且部分數值需除以100
-    soil_temp = (buf[3] << 8 | buf[4]) / 100.0;
-    soil_hum = (buf[5] << 8 | buf[6]) / 100.0;
-    soil_ec = (buf[7] << 8 | buf[8]);
-    soil_salinity = (buf[9] << 8 | buf[10]); // 如果是鹽分通常是 mg/L，如果是 PH 則是 /10.0
+ private:
+  ControlConfig cfg;
+  bool autoOn = true;
+  bool softAlarm = false;
+  bool pump = false;
+  bool fert = false;
+  bool fertDoneToday = false;
+  int16_t doneYday = -1;   // 最後一次自動施肥的 tm_yday
+  uint32_t pumpStartMs = 0;
+  uint32_t pumpRunMs = 0;       // PUMP_RUN 指定的運轉時間，0 = 直到關閉
+  uint32_t fertStartMs = 0;
+  uint32_t stateChangeMs = 0;
+  bool lastSensorError = false;
+  bool lastPumpOverload = false;
+  bool lastFertOverload = false;
+  bool fbPumpError = false;
+  bool fbFertError = false;
+  bool ticked = false;
+  uint32_t lastTickMs = 0;
+  uint32_t pumpAccumMs = 0;
+  uint32_t fertAccumMs = 0;
+  uint32_t pumpMin = 0;     // 累計運轉分鐘 (斷電保存)
+  uint32_t fertMin = 0;
+  uint32_t events = 0;
+};
+
+const ControlConfig controlDefaults = { soilLow, soilHigh, fertHour, fertDuration, pumpMaxRunTime, 2000 };
+FarmController farm(controlDefaults);
+
+// ==========================================
+//  [新增] 控制器效能量測 (MQTT 指令 BENCH_TICK，結果發佈到 farm/metrics)
+//  在獨立的一份控制器上跑，不影響實際狀態；輸入涵蓋上下限切換、過載與回授異常
+// ==========================================
+void runTickBenchmark() {
+  const int iterations = 5000;
+  FarmController bench(farm.config());
+  bench.restore(true, false, -1, 0, 0, 0);
+  ControlInput in = {};
+  in.timeSynced = true;
+  in.haveSensor = in.rs485Ok = true;
+  volatile uint32_t sink = 0;
 
-    return true; // 讀取成功
+  uint32_t total = 0, worst = 0;
+  ControlOutput out = {};
+  for (int i = 0; i < iterations; i++) {
+    in.nowMs = i * 1000;                                  // 每步 1 秒
+    in.hour = (i / 3600) % 24;
+    in.minute = (i / 60) % 60;
+    in.soilHum = 10.0f + (i % 600) * 0.15f;              // 10 ~ 100 % 來回掃過上下限
+    in.pumpOverload = (i % 997) < 3;
+    in.pumpFeedback = (i % 1499) < 5 ? !out.pump : out.pump;
+    in.fertFeedback = out.fert;
+    uint32_t t0 = ESP.getCycleCount();
+    out = bench.tick(in);
+    uint32_t c = ESP.getCycleCount() - t0;
+    total += c;
+    if (c > worst) worst = c;
+    sink += out.status;
   }
-  
-  return false; // 數據校驗錯誤
+
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  char buf[160];
+  snprintf(buf, sizeof(buf),
+           "{\"bench\":\"control_tick\",\"samples\":%d,\"avg_ns\":%u,\"max_ns\":%u,\"state_bytes\":%u}",
+           iterations, (unsigned)((uint64_t)total * 1000 / mhz / iterations),
+           (unsigned)((uint64_t)worst * 1000 / mhz), (unsigned)sizeof(FarmController));
+  client.publish(topic_metrics, buf);
 }
 
 // ==========================================
-//  檢查電磁接觸器回授狀態
+//  [新增] 控制週期用的當地時間
+//  [修改] 不用 getLocalTime(t, 0)：未對時的時候它仍會 delay(10)，控制週期因此加倍
 // ==========================================
-void checkFeedback() {
-    bool isPumpRealOn = (digitalRead(fbPumpPin) == LOW);
-    bool isFertRealOn = (digitalRead(fbFertPin) == LOW);
+bool farmLocalTime(struct tm* t) {
+  time_t now = time(nullptr);
+  localtime_r(&now, t);
+  return t->tm_year > (2016 - 1900); // 與 getLocalTime() 相同的判斷：SNTP 對時前停在 1970 年
+}
 
-    if (millis() - stateChangeTime < 2000) return;
+// [新增] 加速模擬的每日結果 (模擬任務寫入，網路任務依 daysDone 逐日發佈)
+#define SIM_MAX_DAYS 45       // 虛擬時鐘 32 位元毫秒，約 49 天溢位
 
-    if (pumpRunning != isPumpRealOn) {
-        if (!lastFbPumpError) {
-            String msg = pumpRunning ? "⚠️ [回授異常] 水泵啟動失敗！" : "🚨 [危險警報] 水泵異常運轉！";
-            Serial.println(msg);
-            sendDiscord(msg);
-            lastFbPumpError = true;
-        }
-    } else {
-        lastFbPumpError = false;
+struct SimDay {
+  uint16_t pumpCycles;      // 水泵線圈啟動次數
+  uint16_t fertCycles;
+  uint16_t pumpOnMin;       // 接觸器實際吸合分鐘
+  uint16_t fertOnMin;
+  uint16_t lockouts;        // pumpMaxRunTime 超時鎖定
+  uint16_t trips;           // 積熱電驛跳脫
+  uint16_t alerts;
+  uint8_t soilMin;
+  uint8_t soilMax;
+  uint32_t wallUs;          // 實際花掉的時間
+};
+
+struct SimRun {
+  bool pending;             // 指令已收到，等模擬任務開始
+  bool active;
+  ControlConfig cfg;        // 收到指令時的控制設定
+  uint16_t days;
+  uint8_t wetPerMin;        // 水泵吸合時土壤濕度每分鐘上升 (%)
+  uint8_t tripMin;          // 連續運轉幾分鐘積熱電驛跳脫，0 = 不會跳
+  uint16_t daysDone;
+  uint16_t daysPublished;
+  bool finished;            // 全部天數跑完，等網路任務發佈總結
+  SimDay day[SIM_MAX_DAYS];
+};
+
+SimRun sim = {};
+portMUX_TYPE simMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ==========================================
+//  [新增] 分段耗時統計 (CPU cycle counter + 固定桶直方圖)
+//  每個階段只由一個任務記錄，任務都釘在固定核心，所以前後兩次讀 CCOUNT 可直接相減，
+//  也不需要鎖。記一筆 = 兩次讀暫存器 + 一次除法 + 一次 clz，常駐開著也無感。
+//  桶 0 收 0 µs，桶 k 收 [2^(k-1), 2^k) µs，最後一桶收 >= 2^22 µs。
+//  CCOUNT 在 240 MHz 約 17.9 秒溢位，單次超過這個時間的階段會被低估。
+// ==========================================
+enum StageId : uint8_t {
+  STAGE_CTL_CYCLE,      // 控制任務：整個控制週期
+  STAGE_CTL_CMDS,       //           執行佇列中的指令
+  STAGE_CTL_LOCALTIME,  //           localtime_r()
+  STAGE_CTL_TICK,       //           farm.tick()
+  STAGE_SNS_DHT,        // 感測任務：DHT 起始 / 解碼
+  STAGE_SNS_BUS,        //           RS485 排程 + poll + 解析
+  STAGE_NET_PERSIST,    // 網路任務：NVS 延遲寫入
+  STAGE_NET_HISTORY,    //           歷史環形緩衝
+  STAGE_NET_FLASHLOG,   //           flash 日誌寫入 / 補送
+  STAGE_NET_CONN,       //           連線管理
+  STAGE_NET_MQTT_LOOP,  //           client.loop() (含指令解析)
+  STAGE_NET_TELEMETRY,  //           遙測序列化 + 發佈
+  STAGE_NET_METRICS,    //           metrics / probes / relays
+  STAGE_NET_THINGSPEAK, //           bulk_update
+  STAGE_ALERT_DISCORD,  // 警報任務：Discord webhook
+  STAGE_COUNT
+};
+
+const char* const stageNames[STAGE_COUNT] = {
+  "ctl_cycle", "ctl_cmds", "ctl_localtime", "ctl_tick",
+  "sns_dht", "sns_bus",
+  "net_persist", "net_history", "net_flashlog", "net_conn", "net_mqtt_loop",
+  "net_telemetry", "net_metrics", "net_thingspeak",
+  "alert_discord"
+};
+
+#define STAGE_BUCKETS 24
+
+struct StageHist {
+  uint32_t gen;             // 與 stageResetGen 不同時由記錄的任務自行歸零
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t sumUs;
+  uint32_t buckets[STAGE_BUCKETS];
+};
+
+StageHist stageHist[STAGE_COUNT] = {};
+volatile uint32_t stageResetGen = 0;
+uint32_t stageCpuMhz = 240;   // setup() 讀實際頻率
+
+inline void stageRecord(StageId id, uint32_t cycles) {
+  StageHist& h = stageHist[id];
+  uint32_t gen = stageResetGen;
+  if (h.gen != gen) { memset(&h, 0, sizeof(h)); h.gen = gen; }
+  uint32_t us = cycles / stageCpuMhz;
+  uint8_t b = us ? 32 - __builtin_clz(us) : 0;
+  if (b >= STAGE_BUCKETS) b = STAGE_BUCKETS - 1;
+  h.buckets[b]++;
+  h.count++;
+  h.sumUs += us;
+  if (us > h.maxUs) h.maxUs = us;
+}
+
+// 用法：{ StageScope st(STAGE_X); ...要量的程式... }
+struct StageScope {
+  explicit StageScope(StageId id) : id(id), start(ESP.getCycleCount()) {}
+  ~StageScope() { stageRecord(id, ESP.getCycleCount() - start); }
+  StageId id;
+  uint32_t start;
+};
+
+// ==========================================
+//  [新增] Discord 長連線 (HTTPS keep-alive)
+//  TLS 連線與 DNS 結果都保留重複使用，只有斷線時才重新握手
+//  discord_webhook 可改成本地測試伺服器，例如 https://192.168.0.50:8443/hook
+// ==========================================
+struct DiscordLink {
+  char host[64];
+  char path[160];
+  uint16_t port;
+  bool parsed;
+  IPAddress ip;
+  unsigned long dnsTime;
+  bool dnsValid;
+  uint32_t handshakes;      // 完整 TLS 握手次數
+  uint32_t reused;          // 沿用既有連線的請求數
+  uint32_t requests;
+  uint32_t dnsLookups;
+  uint32_t lastHandshakeMs;
+  uint32_t maxHandshakeMs;
+};
+DiscordLink discord = {};
+WiFiClientSecure discordClient;
+const unsigned long discordDnsTtl = 600000;    // DNS 快取 10 分鐘
+const unsigned long discordIoTimeout = 5000;   // 讀取回應逾時
+
+// 拆解 https://host[:port]/path
+bool parseWebhookUrl(const char* url, DiscordLink& d) {
+  const char* p = strstr(url, "://");
+  p = p ? p + 3 : url;
+  const char* hostEnd = p + strcspn(p, ":/");
+  size_t hostLen = hostEnd - p;
+  if (hostLen == 0 || hostLen >= sizeof(d.host)) return false;
+  memcpy(d.host, p, hostLen);
+  d.host[hostLen] = '\0';
+  d.port = 443;
+  if (*hostEnd == ':') d.port = (uint16_t)atoi(hostEnd + 1);
+  const char* path = strchr(hostEnd, '/');
+  strncpy(d.path, path ? path : "/", sizeof(d.path) - 1);
+  d.path[sizeof(d.path) - 1] = '\0';
+  return true;
+}
+
+// 讀一行 HTTP 標頭 (去掉 \r\n)，逾時回傳 -1
+int readHttpLine(Client& c, char* buf, size_t size, unsigned long deadline) {
+  size_t n = 0;
+  while ((long)(deadline - millis()) > 0) {
+    if (!c.available()) {
+      if (!c.connected()) return -1;
+      delay(1);
+      continue;
     }
+    char ch = (char)c.read();
+    if (ch == '\r') continue;
+    if (ch == '\n') { buf[n] = '\0'; return (int)n; }
+    if (n < size - 1) buf[n++] = ch;
+  }
+  return -1;
+}
 
-    if (fertRunning != isFertRealOn) {
-        if (!lastFbFertError) {
-            String msg = fertRunning ? "⚠️ [回授異常] 施肥機啟動失敗！" : "🚨 [危險警報] 施肥機異常運轉！";
-            Serial.println(msg);
-            sendDiscord(msg);
-            lastFbFertError = true;
-        }
+bool discordConnect() {
+  if (!discord.dnsValid || millis() - discord.dnsTime > discordDnsTtl) {
+    discord.dnsLookups++;
+    if (WiFi.hostByName(discord.host, discord.ip) != 1) return false;
+    discord.dnsValid = true;
+    discord.dnsTime = millis();
+  }
+  unsigned long t0 = millis();
+  if (!discordClient.connect(discord.ip, discord.port, discord.host, NULL, NULL, NULL)) {
+    discord.dnsValid = false; // 連不上時下次重新查詢 DNS
+    return false;
+  }
+  discord.handshakes++;
+  discord.lastHandshakeMs = millis() - t0;
+  if (discord.lastHandshakeMs > discord.maxHandshakeMs) discord.maxHandshakeMs = discord.lastHandshakeMs;
+  return true;
+}
+
+// [修改] 讀完一個 HTTP 回應 (狀態列 + 標頭 + 丟棄內容)，Discord 與 ThingSpeak 共用
+// 回傳狀態碼，連線問題回傳 -1；keepAlive = false 時呼叫端要關閉連線
+int readHttpResponse(Client& c, unsigned long deadline, bool& keepAlive) {
+  char line[128];
+  if (readHttpLine(c, line, sizeof(line), deadline) < 12) return -1;
+  int code = atoi(line + 9); // "HTTP/1.1 204 ..."
+
+  long contentLength = -1;
+  keepAlive = true;
+  for (;;) {
+    int len = readHttpLine(c, line, sizeof(line), deadline);
+    if (len < 0) return -1;
+    if (len == 0) break;
+    if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(line + 15);
+    else if (strncasecmp(line, "Connection:", 11) == 0 && strstr(line + 11, "close")) keepAlive = false;
+    else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) keepAlive = false; // 不解析 chunked，讀完就關閉
+  }
+  if (code == 204 || code == 304) contentLength = 0;
+  if (contentLength < 0) { keepAlive = false; return code; } // 無法判斷長度，由呼叫端關閉連線
+
+  // 丟棄回應內容，讓下一個請求從乾淨的位置開始
+  while (contentLength != 0 && (long)(deadline - millis()) > 0) {
+    if (c.available()) {
+      c.read();
+      if (contentLength > 0) contentLength--;
+    } else if (!c.connected()) {
+      break;
     } else {
-        lastFbFertError = false;
+      delay(1);
     }
+  }
+  if (contentLength > 0) keepAlive = false;
+  return code;
+}
+
+// 在目前連線上送出一個 POST 並讀完回應，回傳 HTTP 狀態碼 (連線問題回傳 -1)
+int discordPost(const char* body, size_t bodyLen, bool& keepAlive) {
+  char head[320];
+  int n = snprintf(head, sizeof(head),
+                   "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                   "Content-Length: %u\r\nConnection: keep-alive\r\n\r\n",
+                   discord.path, discord.host, (unsigned)bodyLen);
+  if (discordClient.write((const uint8_t*)head, n) != (size_t)n) return -1;
+  if (discordClient.write((const uint8_t*)body, bodyLen) != bodyLen) return -1;
+
+  return readHttpResponse(discordClient, millis() + discordIoTimeout, keepAlive);
 }
 
 // ==========================================
-//  MQTT 回調函式
+//  Discord 發送函式 (只在警報任務中呼叫，會阻塞)
+//  回傳 true 代表 webhook 回應 2xx
 // ==========================================
-void callback(char* topic, byte* payload, unsigned int length) {
-  String msg = "";
-  for (int i = 0; i < length; i++) {
-    msg += (char)payload[i];
-  }
-  msg.trim(); 
-  Serial.println("收到 MQTT: " + msg);
-
-  bool pumpOverload = (digitalRead(olPumpPin) == LOW);
-  bool fertOverload = (digitalRead(olFertPin) == LOW);
-
-  if (msg.startsWith("LED") && autoMode) {
-      autoMode = false;
-      prefs.putBool("is_auto", false);
-      sendDiscord("👋 [手動介入] 切換為手動模式");
-  }
-  
-  if (msg == "STOP") {
-      autoMode = false; prefs.putBool("is_auto", false); 
-      digitalWrite(pumpPin, LOW); pumpRunning = false;
-      digitalWrite(fertPin, LOW); fertRunning = false;
-      stateChangeTime = millis();
-      sendDiscord("🔴 [警報] 系統緊急停機！");
-  }
-  else if (msg == "AUTO_ON") {
-      autoMode = true; prefs.putBool("is_auto", true); 
-      sendDiscord("🟢 切換為自動模式");
-  }
-  else if (msg == "AUTO_OFF") {
-      autoMode = false; prefs.putBool("is_auto", false); 
-      sendDiscord("🟠 切換為手動模式");
-  }
-  else if (msg == "LED1_ON") { 
-      if (!pumpOverload) {
-          if(fertRunning) { digitalWrite(fertPin, LOW); fertRunning = false; } 
-          digitalWrite(pumpPin, HIGH); pumpRunning = true; pumpStartTime = millis();
-          stateChangeTime = millis();
-      }
+bool sendDiscord(const char* content) {
+  if (WiFi.status() != WL_CONNECTED) return false;
+  if (!discord.parsed) {
+    if (!parseWebhookUrl(discord_webhook, discord)) return false;
+    discordClient.setInsecure();
+    discordClient.setTimeout(discordIoTimeout);
+    discord.parsed = true;
   }
-  else if (msg == "LED1_OFF") { 
-      digitalWrite(pumpPin, LOW); pumpRunning = false;
-      stateChangeTime = millis();
-  }
-  else if (msg == "LED2_ON") { 
-      if (!fertOverload) {
-          if(pumpRunning) { digitalWrite(pumpPin, LOW); pumpRunning = false; } 
-          digitalWrite(fertPin, HIGH); fertRunning = true; fertStartTime = millis();
-          stateChangeTime = millis();
-      }
+
+  char body[200];
+  int bodyLen = snprintf(body, sizeof(body), "{\"content\":\"%s\"}", content);
+  if (bodyLen >= (int)sizeof(body)) bodyLen = sizeof(body) - 1;
+
+  // 沿用的連線可能已被伺服器關閉，失敗時重新握手再試一次
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool reusing = discordClient.connected();
+    if (!reusing && !discordConnect()) return false;
+
+    bool keepAlive = false;
+    int code = discordPost(body, bodyLen, keepAlive);
+    if (code > 0) {
+      discord.requests++;
+      if (reusing) discord.reused++;
+      if (!keepAlive) discordClient.stop();
+      return (code >= 200 && code < 300);
+    }
+    discordClient.stop();
+    if (!reusing) return false;
   }
-  else if (msg == "LED2_OFF") { 
-      digitalWrite(fertPin, LOW); fertRunning = false;
-      stateChangeTime = millis();
+  return false;
+}
+
+// ==========================================
+//  [新增] 警報排隊 (不阻塞，由警報任務送出)
+//  外寄匣滿時丟棄這則並計數，待清空後回報丟棄數量
+// ==========================================
+void raiseAlert(const char* text) {
+  bool queued = false;
+  portENTER_CRITICAL(&outboxMux);
+  if (outbox.count < ALERT_OUTBOX_SIZE) {
+    AlertMsg& a = outbox.slots[(outbox.head + outbox.count) % ALERT_OUTBOX_SIZE];
+    strncpy(a.text, text, sizeof(a.text) - 1);
+    a.text[sizeof(a.text) - 1] = '\0';
+    a.attempts = 0;
+    outbox.count++;
+    queued = true;
+  } else {
+    outbox.dropped++;
+    outbox.droppedUnreported++;
   }
+  portEXIT_CRITICAL(&outboxMux);
+
+  if (queued && alertTaskHandle != NULL) xTaskNotifyGive(alertTaskHandle);
 }
 
-void reconnectMQTT() {
-  if (!client.connected()) {
-    String clientId = "ESP32-" + String(random(0xffff), HEX);
-    if (client.connect(clientId.c_str(), mqtt_user, mqtt_password)) {
-      client.subscribe(topic_control);
+// ==========================================
+//  [新增] 警報任務 (核心 0，最低優先權)
+//  逐則送出外寄匣內容，失敗時指數退避重試
+// ==========================================
+void alertTask(void* arg) {
+  for (;;) {
+    AlertMsg a;
+    bool have = false;
+    uint32_t droppedReport = 0;
+    portENTER_CRITICAL(&outboxMux);
+    if (outbox.count > 0) {
+      a = outbox.slots[outbox.head];
+      have = true;
+    } else if (outbox.droppedUnreported > 0) {
+      droppedReport = outbox.droppedUnreported;
+      outbox.droppedUnreported = 0;
+    }
+    portEXIT_CRITICAL(&outboxMux);
+
+    if (droppedReport > 0) {
+      char msg[96];
+      snprintf(msg, sizeof(msg), "⚠️ [警報] 外寄匣已滿，丟棄 %u 則通知", (unsigned)droppedReport);
+      raiseAlert(msg);
+      continue;
+    }
+    if (!have) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+      vTaskDelay(pdMS_TO_TICKS(1000)); // 斷線期間不消耗重試次數
+      continue;
+    }
+
+    // [修改] 內容只在第一次送出時印出；重試只記次數 (raiseAlert 在控制任務，不在那裡印)
+    if (a.attempts == 0) Serial.println(a.text);
+    else Serial.printf("警報重試 %u/%u\n", (unsigned)a.attempts + 1, (unsigned)alertMaxAttempts);
+    bool ok;
+    {
+      StageScope st(STAGE_ALERT_DISCORD);
+      ok = sendDiscord(a.text);
+    }
+
+    bool gaveUp = false;
+    portENTER_CRITICAL(&outboxMux);
+    AlertMsg& head = outbox.slots[outbox.head];
+    if (ok || ++head.attempts >= alertMaxAttempts) {
+      gaveUp = !ok;
+      if (ok) outbox.sent++; else outbox.failed++;
+      outbox.head = (outbox.head + 1) % ALERT_OUTBOX_SIZE;
+      outbox.count--;
+      a.attempts = 0;
+    } else {
+      outbox.retries++;
+      a.attempts = head.attempts;
+    }
+    portEXIT_CRITICAL(&outboxMux);
+    if (gaveUp) Serial.printf("警報送出失敗 %u 次，放棄\n", (unsigned)alertMaxAttempts);
+
+    if (a.attempts > 0) {
+      uint32_t backoff = alertBackoffBaseMs << (a.attempts - 1);
+      if (backoff > alertBackoffMaxMs) backoff = alertBackoffMaxMs;
+      vTaskDelay(pdMS_TO_TICKS(backoff));
     }
   }
 }
 
-void setup() {
-  WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
-  Serial.begin(115200);
-  
-  // [新增] 初始化 RS485
-  pinMode(DE_RE_PIN, OUTPUT);
-  digitalWrite(DE_RE_PIN, LOW); // 預設接收模式
-  rs485Serial.begin(9600, SERIAL_8N1, RX_PIN, TX_PIN);
-  
-  pinMode(pumpPin, OUTPUT); pinMode(fertPin, OUTPUT);
-  digitalWrite(pumpPin, LOW); digitalWrite(fertPin, LOW); 
-  
-  pinMode(olPumpPin, INPUT_PULLUP); pinMode(olFertPin, INPUT_PULLUP);
-  pinMode(fbPumpPin, INPUT_PULLUP); pinMode(fbFertPin, INPUT_PULLUP);
+// ==========================================
+//  [新增] Modbus RTU 主站 (非阻塞狀態機)
+//  begin() 送出請求後立即返回，poll() 在背景推進：
+//  傳送 -> 等待回應 -> 收齊或字元間隔逾時 -> 驗證 CRC16
+//  只依賴 Stream 介面，可以直接接上模擬的 UART 來驅動
+// ==========================================
+#define MB_MAX_FRAME 256
 
-  stateChangeTime = millis();
-  dht.begin();
+// --- CRC16 (Modbus, 多項式 0xA001) ---
+// 查表版：表格在編譯期產生並放在 flash，執行期每個位元組只需一次查表
+struct Crc16Table {
+  uint16_t v[256];
+};
 
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) { delay(500); }
-  
-  configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-  client.setServer(mqtt_server, mqtt_port);
-  client.setCallback(callback); 
+constexpr Crc16Table makeCrc16Table() {
+  Crc16Table t = {};
+  for (int i = 0; i < 256; i++) {
+    uint16_t crc = i;
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    t.v[i] = crc;
+  }
+  return t;
+}
 
-  prefs.begin("farm_config", false); 
-  autoMode = prefs.getBool("is_auto", true); 
-  
-  sendDiscord("✅ ESP32 系統已啟動 (RS485版)");
+constexpr Crc16Table crc16Table = makeCrc16Table();
+
+constexpr uint16_t modbusCrc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) crc = (crc >> 8) ^ crc16Table.v[(crc ^ data[i]) & 0xFF];
+  return crc;
 }
 
-void loop() {
-  if(WiFi.status() == WL_CONNECTED){
-    
-    if (!client.connected()) {
-        static unsigned long lastReconnect = 0;
-        if (millis() - lastReconnect > 5000) {
-            lastReconnect = millis();
-            reconnectMQTT();
-        }
-    }
-    client.loop(); 
+// 逐位元版：只保留給 BENCH_CRC 比較用
+uint16_t modbusCrc16Bitwise(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+  }
+  return crc;
+}
+
+// ==========================================
+//  [新增] Modbus 訊框產生器
+//  [修改] 執行期與編譯期共用同一組 constexpr 編碼函式與 CRC 核心：
+//  探頭查詢碼與繼電器板訊框 (地址來自設定表) 在執行期呼叫，
+//  參數固定的訊框用 mbReadFrame<> 在編譯時檢查並產生，改地址或數量不必再手算 CRC
+// ==========================================
+template <size_t N>
+struct MbFrame {
+  uint8_t bytes[N];
+  static constexpr size_t size = N;
+  const uint8_t* data() const { return bytes; }
+};
+
+// 讀取：01 線圈 / 02 離散輸入 / 03 保持暫存器 / 04 輸入暫存器，回傳訊框長度
+constexpr size_t mbBuildRead(uint8_t* frame, uint8_t addr, uint8_t fn, uint16_t reg, uint16_t count) {
+  frame[0] = addr;
+  frame[1] = fn;
+  frame[2] = reg >> 8;
+  frame[3] = reg & 0xFF;
+  frame[4] = count >> 8;
+  frame[5] = count & 0xFF;
+  uint16_t crc = modbusCrc16(frame, 6);
+  frame[6] = crc & 0xFF;      // CRC 低位元組在前
+  frame[7] = crc >> 8;
+  return 8;
+}
+
+// 寫入多個線圈 (0F)，bits 的第 0 位對應 coil，回傳訊框長度
+constexpr size_t mbBuildWriteCoils(uint8_t* frame, uint8_t addr, uint16_t coil, uint16_t count, uint32_t bits) {
+  uint8_t nbytes = (count + 7) / 8;
+  frame[0] = addr;
+  frame[1] = 0x0F;
+  frame[2] = coil >> 8;
+  frame[3] = coil & 0xFF;
+  frame[4] = count >> 8;
+  frame[5] = count & 0xFF;
+  frame[6] = nbytes;
+  for (uint8_t i = 0; i < nbytes; i++) frame[7 + i] = (bits >> (8 * i)) & 0xFF;
+  uint16_t crc = modbusCrc16(frame, 7 + nbytes);
+  frame[7 + nbytes] = crc & 0xFF;
+  frame[8 + nbytes] = crc >> 8;
+  return 9 + nbytes;
+}
 
-    unsigned long currentMillis = millis();
-    struct tm timeinfo;
-    bool timeSynced = getLocalTime(&timeinfo);
+template <uint8_t Addr, uint8_t Fn, uint16_t Reg, uint16_t Count>
+constexpr MbFrame<8> mbReadFrame() {
+  static_assert(Addr >= 1 && Addr <= 247, "Modbus 位址需在 1~247");
+  static_assert(Fn >= 0x01 && Fn <= 0x04, "讀取功能碼需為 01~04");
+  static_assert(Count >= 1 && Count <= (Fn <= 0x02 ? 2000 : 125), "讀取數量超出 Modbus 上限");
+  static_assert((uint32_t)Reg + Count <= 0x10000, "暫存器範圍超出 0xFFFF");
+  MbFrame<8> f = {};
+  mbBuildRead(f.bytes, Addr, Fn, Reg, Count);
+  return f;
+}
+
+// 與舊版手算的查詢碼 {0x01,0x03,0x00,0x00,0x00,0x04,0x44,0x09} 對照，確保編碼與 CRC 核心正確
+static_assert(mbReadFrame<0x01, 0x03, 0x0000, 4>().bytes[6] == 0x44 &&
+              mbReadFrame<0x01, 0x03, 0x0000, 4>().bytes[7] == 0x09, "CRC16 查表核心錯誤");
+
+// ==========================================
+//  [新增] CRC16 效能比較 (MQTT 指令 BENCH_CRC，結果發佈到 farm/metrics)
+// ==========================================
+void runCrcBenchmark() {
+  const int iterations = 2000;
+  static uint8_t data[256];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 37 + 11);
+  volatile uint16_t sink = 0;
+
+  uint32_t t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) sink ^= modbusCrc16Bitwise(data, sizeof(data));
+  uint32_t bitwiseCycles = ESP.getCycleCount() - t0;
+
+  t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) sink ^= modbusCrc16(data, sizeof(data));
+  uint32_t tableCycles = ESP.getCycleCount() - t0;
+
+  uint32_t bytes = (uint32_t)iterations * sizeof(data);
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  char buf[224];
+  snprintf(buf, sizeof(buf),
+           "{\"bench\":\"crc16\",\"bytes\":%u,\"bitwise_cyc_per_byte\":%.2f,\"table_cyc_per_byte\":%.2f"
+           ",\"bitwise_mb_s\":%.2f,\"table_mb_s\":%.2f,\"match\":%d}",
+           (unsigned)bytes, (float)bitwiseCycles / bytes, (float)tableCycles / bytes,
+           (float)bytes * mhz / bitwiseCycles, (float)bytes * mhz / tableCycles,
+           modbusCrc16Bitwise(data, sizeof(data)) == modbusCrc16(data, sizeof(data)) ? 1 : 0);
+  client.publish(topic_metrics, buf);
+}
+
+enum MbState : uint8_t { MB_IDLE, MB_SENDING, MB_WAITING, MB_DONE };
+enum MbResult : uint8_t { MB_OK, MB_TIMEOUT, MB_CRC_ERROR, MB_SHORT_FRAME, MB_EXCEPTION, MB_BAD_REPLY };
+
+struct ModbusStats {
+  uint32_t ok;
+  uint32_t timeouts;
+  uint32_t crcErrors;
+  uint32_t shortFrames;
+  uint32_t exceptions;
+  uint32_t badReplies;
+  uint32_t lastLatencyUs;   // 請求送出到回應驗證完成 (整筆交易佔用匯流排的時間)
+  uint32_t maxLatencyUs;
+  uint64_t sumLatencyUs;
+};
+
+// deRePin = -1：UART 以 RS485 半雙工模式自動控制 DE/RE，
+// 並由 RX 逾時中斷呼叫 onFrameGap() 標記訊框結尾
+class ModbusMaster {
+public:
+  ModbusMaster(Stream& port, int deRePin, uint32_t baud, uint32_t timeoutMs = 500)
+    : port(port), deRePin(deRePin), timeoutMs(timeoutMs) {
+    charUs = 11000000UL / baud;            // 1 個字元 = 11 bits (含起始/停止/保險)
+    gapUs = charUs * 7 / 2 + 2000;          // 3.5 字元 + UART 驅動批次交付的餘裕
+  }
+
+  bool idle() const { return state == MB_IDLE; }
+  // 閒置且已經過 3.5 字元的訊框間隔，可以送下一筆
+  bool ready() const { return state == MB_IDLE && micros() - idleSinceUs >= charUs * 7 / 2; }
+  bool done() const { return state == MB_DONE; }
+
+  // 送出一個完整的 RTU 請求 (含 CRC)，忙碌中回傳 false
+  bool begin(const uint8_t* frame, size_t len) {
+    if (state != MB_IDLE || len < 4 || len > MB_MAX_FRAME) return false;
+    memcpy(tx, frame, len);
+    txLen = len;
+    rxLen = 0;
+    exCode = 0;
+    expectedLen = expectedReplyLength(tx, txLen);
+    while (port.available()) port.read();  // 丟棄上一筆殘留的位元組
+    gapFlag = false;
+
+    if (deRePin >= 0) digitalWrite(deRePin, HIGH); // 切換為傳送模式 (TX)
+    port.write(tx, txLen);
+    startUs = micros();
+    state = MB_SENDING;
+    return true;
+  }
 
-    if (timeSynced && timeinfo.tm_hour == 3 && timeinfo.tm_min == 0 && millis() > 120000) {
-        prefs.end(); delay(1000); ESP.restart(); 
+  void poll() {
+    if (state == MB_SENDING) {
+      // 硬體控制方向時不必等傳送完成，回應一定在請求送完之後才會出現；
+      // 手動控制 (或廣播沒有回應) 則依鮑率推算傳送完成時間
+      bool manualOrBroadcast = (deRePin >= 0 || tx[0] == 0);
+      if (manualOrBroadcast && micros() - startUs < (txLen + 1) * charUs) return;
+      if (deRePin >= 0) digitalWrite(deRePin, LOW); // 切換為接收模式 (RX)
+      if (tx[0] == 0) { complete(MB_OK); return; }  // 廣播位址沒有回應
+      lastByteUs = micros();
+      state = MB_WAITING;
     }
+    if (state != MB_WAITING) return;
 
-    // --- 讀取環境數據 ---
-    float airHum = dht.readHumidity();
-    float airTemp = dht.readTemperature();
-    if (isnan(airHum)) airHum = 0;
-    if (isnan(airTemp)) airTemp = 0;
+    // 先取旗標再讀資料：旗標成立時整個訊框已在接收緩衝區內
+    bool gap = gapFlag;
+    while (port.available() && rxLen < MB_MAX_FRAME) {
+      rx[rxLen++] = (uint8_t)port.read();
+      lastByteUs = micros();
+    }
 
-    // --- [修改] 讀取 RS485 土壤感測器 ---
-    static unsigned long lastSensorRead = 0;
-    bool rs485Success = true;
-    
-    // 每 2 秒讀取一次感測器，避免過度查詢阻塞
-    if (currentMillis - lastSensorRead > 2000) {
-        rs485Success = readSoilSensor();
-        lastSensorRead = currentMillis;
+    bool isException = (rxLen >= 5 && (rx[1] & 0x80));
+    if (isException || (expectedLen > 0 && rxLen >= expectedLen)) {
+      complete(validate());
+    } else if (gap && rxLen > 0) {
+      complete(validate());               // 硬體偵測到 3.5 字元靜默 = 訊框結束 (可變長度回應)
+    } else if (rxLen > 0 && micros() - lastByteUs > gapUs) {
+      complete(validate());               // 字元間隔逾時 = 訊框結束
+    } else if (rxLen == 0 && micros() - startUs > timeoutMs * 1000UL) {
+      complete(MB_TIMEOUT);
     }
+  }
+
+  // 取出結果並回到閒置狀態
+  MbResult finish() {
+    state = MB_IDLE;
+    idleSinceUs = micros();
+    return result;
+  }
+
+  const uint8_t* reply() const { return rx; }
+  size_t replyLength() const { return rxLen; }
+  uint8_t exceptionCode() const { return exCode; }
+  uint32_t latencyUs() const { return stats.lastLatencyUs; }
+
+  // UART RX 逾時 (約 3.5 字元無資料) 時由回調呼叫
+  void onFrameGap() { gapFlag = true; }
+
+  ModbusStats stats = {};
 
-    // 判斷感測器是否故障 (DHT 或 RS485 讀取失敗)
-    // 這裡我們把 soil_hum 視為主要控制依據
-    bool sensorError = (isnan(airHum) || !rs485Success || soil_hum == 0.0);
+private:
+  Stream& port;
+  int deRePin;
+  uint32_t timeoutMs;
+  uint32_t charUs;
+  uint32_t gapUs;
+  MbState state = MB_IDLE;
+  MbResult result = MB_OK;
+  uint8_t tx[MB_MAX_FRAME];
+  uint8_t rx[MB_MAX_FRAME];
+  size_t txLen = 0;
+  size_t rxLen = 0;
+  size_t expectedLen = 0;
+  uint8_t exCode = 0;
+  uint32_t startUs = 0;
+  uint32_t lastByteUs = 0;
+  uint32_t idleSinceUs = 0;
+  volatile bool gapFlag = false;
 
-    if (sensorError && !lastSensorErrorState) {
-        sendDiscord("⚠️ [故障] 溫濕度或 RS485 土壤感測器讀取失敗！");
+  // 由請求推算正常回應長度，0 代表未知 (只靠字元間隔判斷結尾)
+  static size_t expectedReplyLength(const uint8_t* req, size_t len) {
+    if (len < 8) return 0;
+    uint16_t count = (req[4] << 8) | req[5];
+    switch (req[1]) {
+      case 0x01: case 0x02: return 5 + (count + 7) / 8;
+      case 0x03: case 0x04: return 5 + 2 * count;
+      case 0x05: case 0x06: case 0x0F: case 0x10: return 8;
+      default: return 0;
     }
-    lastSensorErrorState = sensorError;
+  }
 
-    // --- 過載保護 ---
-    bool pumpOverload = (digitalRead(olPumpPin) == LOW);
-    bool fertOverload = (digitalRead(olFertPin) == LOW);
-    
-    if (pumpOverload && !lastPumpOverloadState) {
-        digitalWrite(pumpPin, LOW); pumpRunning = false;
-        stateChangeTime = currentMillis; 
-        sendDiscord("🚨 [警報] 水泵積熱電驛跳脫！");
+  MbResult validate() {
+    if (rxLen < 4) return MB_SHORT_FRAME;
+    uint16_t crc = rx[rxLen - 2] | (rx[rxLen - 1] << 8);
+    if (modbusCrc16(rx, rxLen - 2) != crc) {
+      return (expectedLen > 0 && rxLen < expectedLen) ? MB_SHORT_FRAME : MB_CRC_ERROR;
     }
-    lastPumpOverloadState = pumpOverload;
+    if (rx[0] != tx[0]) return MB_BAD_REPLY;
+    if (rx[1] == (tx[1] | 0x80)) { exCode = rx[2]; return MB_EXCEPTION; }
+    if (rx[1] != tx[1]) return MB_BAD_REPLY;
+    if (expectedLen > 0 && rxLen != expectedLen) return rxLen < expectedLen ? MB_SHORT_FRAME : MB_BAD_REPLY;
+    if ((rx[1] >= 0x01 && rx[1] <= 0x04) && rx[2] != rxLen - 5) return MB_BAD_REPLY;
+    return MB_OK;
+  }
 
-    if (fertOverload && !lastFertOverloadState) {
-        digitalWrite(fertPin, LOW); fertRunning = false;
-        stateChangeTime = currentMillis; 
-        sendDiscord("🚨 [警報] 施肥機積熱電驛跳脫！");
+  void complete(MbResult r) {
+    result = r;
+    uint32_t latency = micros() - startUs;
+    stats.lastLatencyUs = latency;
+    if (latency > stats.maxLatencyUs) stats.maxLatencyUs = latency;
+    stats.sumLatencyUs += latency;
+    switch (r) {
+      case MB_OK:          stats.ok++; break;
+      case MB_TIMEOUT:     stats.timeouts++; break;
+      case MB_CRC_ERROR:   stats.crcErrors++; break;
+      case MB_SHORT_FRAME: stats.shortFrames++; break;
+      case MB_EXCEPTION:   stats.exceptions++; break;
+      case MB_BAD_REPLY:   stats.badReplies++; break;
     }
-    lastFertOverloadState = fertOverload;
+    state = MB_DONE;
+  }
+};
 
-    if (pumpOverload && pumpRunning) { digitalWrite(pumpPin, LOW); pumpRunning = false; stateChangeTime = currentMillis;}
-    if (fertOverload && fertRunning) { digitalWrite(fertPin, LOW); fertRunning = false; stateChangeTime = currentMillis;}
+ModbusMaster rs485Bus(rs485Serial, -1, 9600, soilReplyTimeoutMs);
 
-    checkFeedback(); 
+// UART2 的 RX 逾時回調 (onlyOnTimeout)：標記訊框結束並立刻喚醒感測任務
+void rs485RxCallback() {
+  rs485Bus.onFrameGap();
+  if (sensorTaskHandle != NULL) xTaskNotifyGive(sensorTaskHandle);
+}
 
-    // --- 自動化邏輯 (使用 soil_hum 替代舊的 soilPercent) ---
-    if (autoMode) {
-        if (timeSynced && !fertOverload) { 
-          if (timeinfo.tm_hour == fertHour && timeinfo.tm_min == 0 && !fertRunning && !fertJobDoneToday) {
-            if (pumpRunning) { digitalWrite(pumpPin, LOW); pumpRunning = false; } 
-            digitalWrite(fertPin, HIGH); fertRunning = true; fertStartTime = currentMillis; fertJobDoneToday = true;
-            stateChangeTime = currentMillis; 
-            sendDiscord("💧 [自動] 開始施肥");
-          }
-          if (fertRunning && (currentMillis - fertStartTime) >= (fertDuration * 60 * 1000)) {
-               digitalWrite(fertPin, LOW); fertRunning = false;
-               stateChangeTime = currentMillis; 
-               sendDiscord("✅ [自動] 施肥完成");
-          }
-          if (timeinfo.tm_hour == 0 && timeinfo.tm_min == 0) fertJobDoneToday = false;
-        }
-        
-        if (!pumpSoftAlarm && !pumpOverload && !sensorError) { 
-          // 這裡直接使用 soil_hum (RS485讀到的百分比)
-          if (soil_hum < soilLow && !pumpRunning && !fertRunning) {
-            digitalWrite(pumpPin, HIGH); pumpRunning = true; pumpStartTime = currentMillis;
-            stateChangeTime = currentMillis; 
-          }
-          else if (soil_hum > soilHigh && pumpRunning) {
-            digitalWrite(pumpPin, LOW); pumpRunning = false;
-            stateChangeTime = currentMillis; 
-          }
-        } else if ((sensorError || pumpOverload) && pumpRunning) {
-            digitalWrite(pumpPin, LOW); pumpRunning = false;
-            stateChangeTime = currentMillis; 
-        }
-    } 
-    
-    if (pumpRunning && ((currentMillis - pumpStartTime) / 60000 >= pumpMaxRunTime)) {
-        digitalWrite(pumpPin, LOW); pumpRunning = false; pumpSoftAlarm = true;
-        stateChangeTime = currentMillis; 
-        sendDiscord("⚠️ [超時] 水泵運轉過久鎖定");
-    }
-
-    int status = 0;
-    if (pumpRunning)   status |= 1;
-    if (fertRunning)   status |= 2;
-    if (pumpSoftAlarm) status |= 4;
-    if (sensorError)   status |= 8;
-    if (autoMode)      status |= 16;
-    if (pumpOverload)  status |= 32;
-    if (fertOverload)  status |= 64;
-    if (lastFbPumpError) status |= 128; 
-    if (lastFbFertError) status |= 256; 
-
-    // --- MQTT 發送數據 (包含新要素) ---
-    if (currentMillis - lastMqttTime >= mqttInterval) {
-        lastMqttTime = currentMillis;
-        if (client.connected()) {
-            // [修改] JSON 格式加入 soil_temp, ec, salinity
-            String json = "{\"temp\":" + String(airTemp, 1) + 
-                          ",\"hum\":" + String(airHum, 1) + 
-                          ",\"soil_hum\":" + String(soil_hum, 1) + 
-                          ",\"soil_temp\":" + String(soil_temp, 1) + 
-                          ",\"ec\":" + String(soil_ec) + 
-                          ",\"salinity\":" + String(soil_salinity) + 
-                          ",\"status\":" + String(status) + "}";
-            client.publish(topic_data, json.c_str());
-        }
+// ==========================================
+//  [新增] 多探頭資料表與輪詢排程
+//  每次匯流排空閒時，從「已到期」的探頭中挑優先權最高、
+//  同優先權則等最久的那一個，達到匯流排允許的最高速率
+// ==========================================
+// 一筆合併後的讀取請求
+struct SoilReadBlock {
+  uint16_t start;
+  uint16_t count;
+  uint8_t query[8];         // 初始化時算好的查詢碼 (含 CRC)
+};
+
+struct SoilProbe {
+  SoilProbeConfig cfg;
+  SoilReadBlock blocks[MAX_READ_BLOCKS];
+  uint8_t blockCount;
+  uint16_t fieldMask;       // 此型號提供哪些欄位 (1 << SoilField)
+  float values[SOIL_FIELD_COUNT];
+  float staging[SOIL_FIELD_COUNT]; // 多個請求全部成功才一起更新
+  bool online;
+  uint8_t failStreak;
+  unsigned long nextDue;
+  uint32_t polls;
+  uint32_t ok;
+  uint32_t timeouts;
+  uint32_t errors;          // CRC / 短訊框 / 例外回應 / 格式錯誤
+  uint32_t lastLatencyUs;
+};
+
+struct SoilBusStats {
+  uint32_t sweeps;
+  uint32_t lastSweepMs;
+  uint32_t maxSweepMs;
+  uint32_t overBudget;
+};
+
+SoilProbe soilProbes[MAX_SOIL_PROBES];
+uint8_t soilProbeCount = 0;
+SoilBusStats soilBusStats = {};
+portMUX_TYPE probesMux = portMUX_INITIALIZER_UNLOCKED;
+
+// 依暫存器對照表規劃最少的讀取請求
+void planSoilReads(SoilProbe& p) {
+  const ProbeModel& m = *p.cfg.model;
+  uint16_t regs[32];
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < m.regCount && n < 32; i++) regs[n++] = m.regs[i].reg;
+  // 插入排序 (欄位很少)
+  for (uint8_t i = 1; i < n; i++) {
+    uint16_t r = regs[i];
+    int j = i - 1;
+    while (j >= 0 && regs[j] > r) { regs[j + 1] = regs[j]; j--; }
+    regs[j + 1] = r;
+  }
+
+  p.blockCount = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    SoilReadBlock* last = p.blockCount ? &p.blocks[p.blockCount - 1] : NULL;
+    if (last) {
+      uint16_t end = last->start + last->count;       // 目前區塊之後的第一個暫存器
+      uint16_t merged = regs[i] - last->start + 1;
+      if (regs[i] < end) continue;                    // 重複的暫存器
+      if (regs[i] - end <= m.maxGap && merged <= 125) { last->count = merged; continue; }
+    }
+    // [修改] 請求數用完時不再硬併進最後一塊 (會讀到未定義位址)，放棄剩下的暫存器
+    if (p.blockCount == MAX_READ_BLOCKS) {
+      Serial.printf("探頭 %u (%s)：暫存器 0x%04X 超出 %d 個讀取請求，不讀取\n",
+                    (unsigned)p.cfg.addr, m.name, (unsigned)regs[i], MAX_READ_BLOCKS);
+      continue;
+    }
+    p.blocks[p.blockCount++] = {regs[i], 1, {}};
+  }
+
+  // 只標記真的有讀到的欄位
+  p.fieldMask = 0;
+  for (uint8_t i = 0; i < m.regCount; i++) {
+    for (uint8_t b = 0; b < p.blockCount; b++) {
+      if (m.regs[i].reg >= p.blocks[b].start && m.regs[i].reg < p.blocks[b].start + p.blocks[b].count) {
+        p.fieldMask |= (1 << m.regs[i].field);
+        break;
+      }
     }
+  }
+  for (uint8_t b = 0; b < p.blockCount; b++) {
+    mbBuildRead(p.blocks[b].query, p.cfg.addr, 0x03, p.blocks[b].start, p.blocks[b].count);
+  }
+}
+
+void initSoilProbes() {
+  soilProbeCount = 0;
+  for (const SoilProbeConfig& c : soilProbeConfig) {
+    if (soilProbeCount >= MAX_SOIL_PROBES) break;
+    SoilProbe& p = soilProbes[soilProbeCount++];
+    p = {};
+    p.cfg = c;
+    planSoilReads(p);
+  }
+}
+
+// 挑下一個要輪詢的探頭，沒有到期的回傳 -1
+int pickNextProbe(unsigned long now) {
+  int best = -1;
+  for (int i = 0; i < soilProbeCount; i++) {
+    const SoilProbe& p = soilProbes[i];
+    if ((long)(now - p.nextDue) < 0) continue;
+    if (best < 0 || p.cfg.priority < soilProbes[best].cfg.priority ||
+        (p.cfg.priority == soilProbes[best].cfg.priority && (long)(p.nextDue - soilProbes[best].nextDue) < 0)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// ==========================================
+//  [新增] RS485 土壤數據解析 (回應已通過 CRC 驗證)
+//  依對照表把區塊內的暫存器換算成欄位數值
+// ==========================================
+bool parseSoilBlock(SoilProbe& p, const SoilReadBlock& b, const uint8_t* buf, size_t len) {
+  // 檢查回應頭 (功能03, 字節數)，地址已由 ModbusMaster 驗證
+  if (len != 5 + 2 * (size_t)b.count || buf[1] != 0x03 || buf[2] != 2 * b.count) return false;
+
+  const ProbeModel& m = *p.cfg.model;
+  for (uint8_t i = 0; i < m.regCount; i++) {
+    const RegisterDesc& d = m.regs[i];
+    if (d.reg < b.start || d.reg >= b.start + b.count) continue;
+    // 數值為 Big Endian
+    size_t off = 3 + 2 * (d.reg - b.start);
+    uint16_t raw = (buf[off] << 8) | buf[off + 1];
+    p.staging[d.field] = (d.isSigned ? (float)(int16_t)raw : (float)raw) * d.scale;
+  }
+  return true;
+}
 
-    // --- ThingSpeak 上傳 (欄位需自行對應) ---
-    if (currentMillis - lastUploadTime >= uploadInterval) {
-      lastUploadTime = currentMillis;
-      // 注意：ThingSpeak 欄位有限，這裡示範將新數據填入 Field 5, 6
-      String url = "http://api.thingspeak.com/update?api_key=" + writeApiKey + 
-                   "&field1=" + String(airTemp) + "&field2=" + String(airHum) + 
-                   "&field3=" + String(soil_hum) + "&field4=" + String(status) +
-                   "&field5=" + String(soil_ec) + "&field6=" + String(soil_temp); 
-      HTTPClient http;
-      http.begin(url.c_str());
-      http.GET();
-      http.end();
+// 記錄一個區塊的交易結果；回傳 true 代表同一探頭還有下一個區塊要讀
+bool soilBlockDone(int i, uint8_t block, MbResult r, unsigned long now) {
+  SoilProbe& p = soilProbes[i];
+  bool ok = (r == MB_OK) && parseSoilBlock(p, p.blocks[block], rs485Bus.reply(), rs485Bus.replyLength());
+  if (ok && block + 1 < p.blockCount) return true;
+
+  portENTER_CRITICAL(&probesMux);
+  p.polls++;
+  p.lastLatencyUs = rs485Bus.latencyUs();
+  if (ok) {
+    p.ok++;
+    memcpy(p.values, p.staging, sizeof(p.values));
+    p.online = true;
+    p.failStreak = 0;
+  } else {
+    if (r == MB_TIMEOUT) p.timeouts++; else p.errors++;
+    if (p.failStreak < 255) p.failStreak++;
+    if (p.failStreak >= soilOfflineAfter) p.online = false;
+  }
+  portEXIT_CRITICAL(&probesMux);
+
+  // 以排程時間累加，維持固定輪詢率；落後太多則從現在重新起算，避免補課式連發
+  uint32_t period = (p.failStreak >= soilOfflineAfter) ? soilOfflineRetryMs : p.cfg.periodMs;
+  p.nextDue += period;
+  if ((long)(now - p.nextDue) > 0) p.nextDue = now;
+  return false;
+}
+
+// 參與控制的在線探頭取平均，作為自動灌溉依據；全部離線回傳 false
+bool aggregateSoil(SensorSnapshot& snap) {
+  float sum[SOIL_FIELD_COUNT] = {};
+  int count[SOIL_FIELD_COUNT] = {};
+  for (int i = 0; i < soilProbeCount; i++) {
+    const SoilProbe& p = soilProbes[i];
+    if (!p.cfg.control || !p.online) continue;
+    for (int f = 0; f < SOIL_FIELD_COUNT; f++) {
+      if (!(p.fieldMask & (1 << f))) continue;
+      sum[f] += p.values[f];
+      count[f]++;
     }
+  }
+  if (count[SF_HUM] == 0) return false; // 沒有水分讀值就無法控制
+  snap.soilHum = sum[SF_HUM] / count[SF_HUM];
+  snap.soilTemp = count[SF_TEMP] ? sum[SF_TEMP] / count[SF_TEMP] : 0;
+  snap.ec = count[SF_EC] ? lroundf(sum[SF_EC] / count[SF_EC]) : 0;
+  snap.salinity = count[SF_SALINITY] ? lroundf(sum[SF_SALINITY] / count[SF_SALINITY]) : 0;
+  return true;
+}
+
+// ==========================================
+//  [新增] RS485 繼電器板驅動
+//  控制端只改 desired 位元遮罩；感測任務在匯流排空檔用一筆 0x0F
+//  把整塊板的線圈一次寫入，再用 0x01 讀回確認
+// ==========================================
+enum RelayOp : uint8_t { RELAY_NONE, RELAY_WRITE, RELAY_READ };
+
+struct RelayBoard {
+  RelayBoardConfig cfg;
+  uint32_t desired;         // 控制端要求的線圈狀態
+  uint32_t actual;          // 最後一次讀回的線圈狀態
+  uint32_t inFlight;        // 正在寫入的值
+  bool dirty;               // desired 尚未寫入
+  bool verifyPending;       // 寫入後待讀回
+  RelayOp op;
+  unsigned long lastVerify;
+  unsigned long retryAt;
+  uint32_t writes;
+  uint32_t reads;
+  uint32_t mismatches;      // 讀回與要求不符 (會自動重寫)
+  uint32_t errors;
+};
+
+RelayBoard relayBoards[MAX_RELAY_BOARDS];
+uint8_t relayBoardCount = 0;
+portMUX_TYPE relayMux = portMUX_INITIALIZER_UNLOCKED;
+
+void initRelayBoards() {
+  relayBoardCount = 0;
+  for (const RelayBoardConfig& c : relayBoardConfig) {
+    if (c.coils == 0) continue;
+    if (relayBoardCount >= MAX_RELAY_BOARDS) break;
+    RelayBoard& b = relayBoards[relayBoardCount++];
+    b = {};
+    b.cfg = c;
+    b.dirty = true; // 開機先寫一次全關，與板子狀態同步
+  }
+}
+
+// 控制任務呼叫：只改記憶體，不碰匯流排
+bool setValve(uint16_t index, bool on) {
+  for (uint8_t i = 0; i < relayBoardCount; i++) {
+    RelayBoard& b = relayBoards[i];
+    if (index >= b.cfg.coils) { index -= b.cfg.coils; continue; }
+    portENTER_CRITICAL(&relayMux);
+    uint32_t before = b.desired;
+    if (on) b.desired |= (1UL << index); else b.desired &= ~(1UL << index);
+    if (b.desired != before) b.dirty = true;
+    portEXIT_CRITICAL(&relayMux);
+    if (sensorTaskHandle != NULL) xTaskNotifyGive(sensorTaskHandle);
+    return true;
+  }
+  return false;
+}
+
+void allValvesOff() {
+  portENTER_CRITICAL(&relayMux);
+  for (uint8_t i = 0; i < relayBoardCount; i++) {
+    if (relayBoards[i].desired != 0) relayBoards[i].dirty = true;
+    relayBoards[i].desired = 0;
+  }
+  portEXIT_CRITICAL(&relayMux);
+  if (sensorTaskHandle != NULL) xTaskNotifyGive(sensorTaskHandle);
+}
+
+// 找出有工作 (待寫入優先，其次待讀回/定期確認) 的繼電器板，沒有回傳 -1
+int pickRelayJob(unsigned long now) {
+  int verifyCandidate = -1;
+  for (uint8_t i = 0; i < relayBoardCount; i++) {
+    const RelayBoard& b = relayBoards[i];
+    if ((long)(now - b.retryAt) < 0) continue;
+    if (b.dirty) return i;
+    if (verifyCandidate < 0 && (b.verifyPending || now - b.lastVerify >= relayVerifyMs)) verifyCandidate = i;
+  }
+  return verifyCandidate;
+}
+
+void relayBegin(int i) {
+  RelayBoard& b = relayBoards[i];
+  uint8_t frame[16];
+  size_t len;
+  portENTER_CRITICAL(&relayMux);
+  b.op = b.dirty ? RELAY_WRITE : RELAY_READ;
+  b.inFlight = b.desired;
+  portEXIT_CRITICAL(&relayMux);
+  if (b.op == RELAY_WRITE) len = mbBuildWriteCoils(frame, b.cfg.addr, 0, b.cfg.coils, b.inFlight);
+  else len = mbBuildRead(frame, b.cfg.addr, 0x01, 0, b.cfg.coils);
+  rs485Bus.begin(frame, len);
+}
+
+void relayDone(int i, MbResult r, unsigned long now) {
+  RelayBoard& b = relayBoards[i];
+  const uint8_t* buf = rs485Bus.reply();
+  portENTER_CRITICAL(&relayMux);
+  if (r != MB_OK) {
+    b.errors++;
+    b.retryAt = now + relayRetryMs;
+  } else if (b.op == RELAY_WRITE) {
+    b.writes++;
+    if (b.desired == b.inFlight) b.dirty = false; // 寫入期間又有變更就再寫一次
+    b.verifyPending = true;
   } else {
-      WiFi.disconnect(); WiFi.reconnect(); delay(1000);
+    uint32_t bits = 0;
+    for (uint8_t k = 0; k < buf[2] && k < 4; k++) bits |= (uint32_t)buf[3 + k] << (8 * k);
+    b.reads++;
+    b.actual = bits;
+    b.lastVerify = now;
+    b.verifyPending = false;
+    if (!b.dirty && b.actual != b.desired) {
+      b.mismatches++;
+      b.dirty = true;
+    }
   }
-  delay(10); 
+  b.op = RELAY_NONE;
+  portEXIT_CRITICAL(&relayMux);
+}
+
+// ==========================================
+//  [新增] GPIO 中斷服務 (DHT 與積熱電驛共用)
+//  以 ESP_INTR_FLAG_IRAM 安裝：NVS 寫入、流水記錄抹除/寫入期間 flash 快取關閉，
+//  中斷仍會照常進來。代價是掛上的每個 handler 只能碰 IRAM 程式碼與 DRAM 資料。
+//  重複呼叫沒關係 (已安裝時回傳 ESP_ERR_INVALID_STATE)。
+// ==========================================
+bool gpioIsrBegin() {
+  esp_err_t err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  return err == ESP_OK || err == ESP_ERR_INVALID_STATE;
+}
+
+// ==========================================
+//  [新增] DHT 非阻塞驅動 (邊緣時間戳 ISR)
+//  DHT 函式庫讀取時會關中斷忙等約 5ms；改成：
+//  拉低 20ms (不佔 CPU) -> 放開後由 ISR 記錄每個下降緣時間 -> 收完再解碼。
+//  每個位元 = 50us 低 + 26us(0)/70us(1) 高，相鄰下降緣間隔約 76us / 120us。
+// ==========================================
+#define DHT_MAX_EDGES 48
+enum DhtState : uint8_t { DHT_IDLE, DHT_START, DHT_CAPTURE, DHT_DONE };
+enum DhtResult : uint8_t { DHT_OK, DHT_NO_REPLY, DHT_CHECKSUM };
+
+struct DhtStats {
+  uint32_t ok;
+  uint32_t noReply;     // 下降緣數量不足 (未接/線路問題)
+  uint32_t checksum;
+};
+
+class DhtReader {
+ public:
+  DhtReader(uint8_t pin) : pin(pin) {}
+
+  void begin() {
+    pinMode(pin, INPUT_PULLUP);
+    gpioIsrBegin();
+    state = DHT_IDLE;
+  }
+
+  // 送出起始訊號 (拉低)，立即返回
+  void start() {
+    if (state != DHT_IDLE) return;
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+    startMs = millis();
+    state = DHT_START;
+  }
+
+  // 由感測任務頻繁呼叫，推進狀態機
+  void poll() {
+    if (state == DHT_START && millis() - startMs >= 20) {
+      edgeCount = 0;
+      captureMs = millis();
+      pinMode(pin, INPUT_PULLUP);
+      gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_NEGEDGE);
+      gpio_isr_handler_add((gpio_num_t)pin, dhtEdgeIsr, this);
+      state = DHT_CAPTURE;
+    } else if (state == DHT_CAPTURE && (millis() - captureMs >= 10 || edgeCount >= DHT_MAX_EDGES)) {
+      gpio_isr_handler_remove((gpio_num_t)pin); // 整個訊框約 5ms，10ms 後一定結束
+      state = DHT_DONE;
+    }
+  }
+
+  bool done() const { return state == DHT_DONE; }
+
+  // 解碼並回到 IDLE
+  DhtResult finish(float& hum, float& temp) {
+    state = DHT_IDLE;
+    uint8_t n = edgeCount;
+    if (n < 41) { stats.noReply++; return DHT_NO_REPLY; }
+
+    // 取最後 41 個下降緣 (40 個位元週期)，前面多出來的是回應訊號
+    uint8_t data[5] = {0};
+    const uint32_t* e = edges + (n - 41);
+    for (uint8_t i = 0; i < 40; i++) {
+      uint32_t period = e[i + 1] - e[i];
+      data[i / 8] <<= 1;
+      if (period > 98) data[i / 8] |= 1;
+    }
+    if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4]) { stats.checksum++; return DHT_CHECKSUM; }
+
+#if DHTTYPE == 22
+    hum = ((data[0] << 8) | data[1]) * 0.1f;
+    temp = (((data[2] & 0x7F) << 8) | data[3]) * 0.1f;
+    if (data[2] & 0x80) temp = -temp;
+#else
+    hum = data[0] + data[1] * 0.1f;
+    temp = data[2] + (data[3] & 0x7F) * 0.1f;
+    if (data[3] & 0x80) temp = -temp;
+#endif
+    stats.ok++;
+    return DHT_OK;
+  }
+
+  // 給 ISR 呼叫 (esp_timer_get_time 在 IRAM)
+  void IRAM_ATTR onEdge() {
+    if (edgeCount < DHT_MAX_EDGES) edges[edgeCount++] = (uint32_t)esp_timer_get_time();
+  }
+
+  DhtStats stats = {};
+
+ private:
+  static void dhtEdgeIsr(void* arg);
+  uint8_t pin;
+  volatile DhtState state = DHT_IDLE;
+  unsigned long startMs = 0;
+  unsigned long captureMs = 0;
+  uint32_t edges[DHT_MAX_EDGES];
+  volatile uint8_t edgeCount = 0;
+};
+
+DhtReader dhtReader(DHTPIN);
+
+void IRAM_ATTR DhtReader::dhtEdgeIsr(void* arg) {
+  static_cast<DhtReader*>(arg)->onEdge();
+}
+
+// ==========================================
+//  [新增] 固定緩衝 JSON 寫入器 (不配置記憶體)
+//  整數與定點小數自己轉字串，不經過 String / printf；
+//  寫滿時停止並標記 overflow，不會越界
+// ==========================================
+class JsonWriter {
+ public:
+  JsonWriter(char* buf, size_t cap) : buf(buf), cap(cap) {}
+
+  void beginObject() { put('{'); first = true; }
+  void endObject() { put('}'); if (len < cap) buf[len] = '\0'; }
+
+  void field(const char* k, int32_t v) {
+    key(k);
+    putInt(v);
+  }
+
+  // 定點小數，例如 decimals=1 時 23.46 -> "23.5" (四捨五入，與 String(v, 1) 相同)
+  void fieldFixed(const char* k, float v, uint8_t decimals) {
+    key(k);
+    if (isnan(v)) { putStr("null"); return; }
+    int32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) scale *= 10;
+    int32_t scaled = lroundf(v * scale);
+    if (scaled < 0) { put('-'); scaled = -scaled; }
+    putInt(scaled / scale);
+    if (decimals == 0) return;
+    put('.');
+    int32_t frac = scaled % scale;
+    for (int32_t d = scale / 10; d > 0; d /= 10) { put('0' + frac / d); frac %= d; }
+  }
+
+  const char* data() const { return buf; }
+  size_t length() const { return len; }
+  bool overflow() const { return over; }
+
+ private:
+  void put(char c) {
+    if (len + 1 < cap) buf[len++] = c; // 保留結尾 '\0'
+    else over = true;
+  }
+  void putStr(const char* s) { while (*s) put(*s++); }
+  void putInt(int32_t v) {
+    char tmp[11];
+    uint8_t n = 0;
+    uint32_t u = v < 0 ? (uint32_t)(-(int64_t)v) : (uint32_t)v;
+    if (v < 0) put('-');
+    do { tmp[n++] = '0' + u % 10; u /= 10; } while (u);
+    while (n) put(tmp[--n]);
+  }
+  void key(const char* k) {
+    if (!first) put(',');
+    first = false;
+    put('"');
+    putStr(k);
+    put('"');
+    put(':');
+  }
+
+  char* buf;
+  size_t cap;
+  size_t len = 0;
+  bool first = true;
+  bool over = false;
+};
+
+// farm/monitor 遙測 (欄位與原本的 String 版本完全相同)
+size_t writeTelemetryJson(const FarmTelemetry& t, char* buf, size_t cap) {
+  JsonWriter w(buf, cap);
+  w.beginObject();
+  w.fieldFixed("temp", t.airTemp, 1);
+  w.fieldFixed("hum", t.airHum, 1);
+  w.fieldFixed("soil_hum", t.soilHum, 1);
+  w.fieldFixed("soil_temp", t.soilTemp, 1);
+  w.field("ec", t.ec);
+  w.field("salinity", t.salinity);
+  w.field("status", t.status);
+  w.endObject();
+  return w.overflow() ? 0 : w.length();
+}
+
+// ==========================================
+//  [新增] 判斷遙測是否值得送出 (任一欄位變化超過死區)
+// ==========================================
+bool telemetryExceedsDeadband(const FarmTelemetry& a, const FarmTelemetry& b) {
+  const TelemetryDeadband& d = telemetryDeadband;
+  return fabsf(a.airTemp - b.airTemp) >= d.airTemp ||
+         fabsf(a.airHum - b.airHum) >= d.airHum ||
+         fabsf(a.soilHum - b.soilHum) >= d.soilHum ||
+         fabsf(a.soilTemp - b.soilTemp) >= d.soilTemp ||
+         abs(a.ec - b.ec) >= d.ec ||
+         abs(a.salinity - b.salinity) >= d.salinity;
+}
+
+// ==========================================
+//  [新增] 二進位精簡遙測 (farm/monitor/bin)
+//  little-endian，第 0 位元組為版本號；之後新增欄位一律接在最後並加版本號，
+//  舊的解碼端只讀它認得的部分，不會壞掉。
+//  v1 (15 bytes):
+//    [0]     版本 = 1
+//    [1..2]  temp       int16  x10
+//    [3..4]  hum        uint16 x10
+//    [5..6]  soil_hum   uint16 x10
+//    [7..8]  soil_temp  int16  x10
+//    [9..10] ec         uint16
+//    [11..12] salinity  uint16
+//    [13..14] status    uint16 (位元定義同 JSON)
+// ==========================================
+#define TELEMETRY_BIN_VERSION 1
+#define TELEMETRY_BIN_SIZE 15
+
+static void putLe16(uint8_t* p, int32_t v, int32_t lo, int32_t hi) {
+  if (v < lo) v = lo;
+  if (v > hi) v = hi;
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+size_t packTelemetry(const FarmTelemetry& t, uint8_t* out) {
+  out[0] = TELEMETRY_BIN_VERSION;
+  putLe16(out + 1,  lroundf(t.airTemp * 10),  INT16_MIN, INT16_MAX);
+  putLe16(out + 3,  lroundf(t.airHum * 10),   0, UINT16_MAX);
+  putLe16(out + 5,  lroundf(t.soilHum * 10),  0, UINT16_MAX);
+  putLe16(out + 7,  lroundf(t.soilTemp * 10), INT16_MIN, INT16_MAX);
+  putLe16(out + 9,  t.ec,       0, UINT16_MAX);
+  putLe16(out + 11, t.salinity, 0, UINT16_MAX);
+  putLe16(out + 13, t.status,   0, UINT16_MAX);
+  return TELEMETRY_BIN_SIZE;
+}
+
+// 直接串流到 MQTT 封包，不經過 PubSubClient 內部緩衝的再次複製
+bool publishRaw(const char* topic, const uint8_t* data, size_t len) {
+  if (!client.beginPublish(topic, len, false)) return false;
+  client.write(data, len);
+  return client.endPublish() == 1;
+}
+
+// ==========================================
+//  [新增] 遙測序列化效能比較 (MQTT 指令 BENCH_JSON，結果發佈到 farm/metrics)
+// ==========================================
+void runTelemetryBenchmark() {
+  const int iterations = 1000;
+  FarmTelemetry t = {23.46f, 61.04f, 35.55f, 19.95f, 1234, 456, 0};
+  volatile size_t sink = 0;
+
+  uint32_t heapBefore = ESP.getFreeHeap();
+  uint32_t t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) {
+    t.soilHum += 0.01f; // 每次數值不同，避免被最佳化掉
+    String json = "{\"temp\":" + String(t.airTemp, 1) +
+                  ",\"hum\":" + String(t.airHum, 1) +
+                  ",\"soil_hum\":" + String(t.soilHum, 1) +
+                  ",\"soil_temp\":" + String(t.soilTemp, 1) +
+                  ",\"ec\":" + String(t.ec) +
+                  ",\"salinity\":" + String(t.salinity) +
+                  ",\"status\":" + String(t.status) + "}";
+    sink += json.length();
+  }
+  uint32_t stringCycles = ESP.getCycleCount() - t0;
+  size_t stringBytes = sink / iterations;
+
+  char buf[160];
+  sink = 0;
+  t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) {
+    t.soilHum += 0.01f;
+    sink += writeTelemetryJson(t, buf, sizeof(buf));
+  }
+  uint32_t writerCycles = ESP.getCycleCount() - t0;
+  size_t writerBytes = sink / iterations;
+  int32_t heapDelta = (int32_t)ESP.getFreeHeap() - (int32_t)heapBefore;
+
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  char out[224];
+  snprintf(out, sizeof(out),
+           "{\"bench\":\"telemetry_json\",\"samples\":%d,\"string_ns\":%u,\"string_bytes\":%u"
+           ",\"writer_ns\":%u,\"writer_bytes\":%u,\"heap_delta\":%d}",
+           iterations, (unsigned)((uint64_t)stringCycles * 1000 / mhz / iterations), (unsigned)stringBytes,
+           (unsigned)((uint64_t)writerCycles * 1000 / mhz / iterations), (unsigned)writerBytes, (int)heapDelta);
+  client.publish(topic_metrics, out);
+}
+
+// ==========================================
+//  [新增] 發佈分段耗時 (MQTT 指令 STAGES，在網路任務執行)
+//  百分位數取所在桶的上界 (不超過 max)，誤差在 2 倍以內，足以找出異常的階段。
+//  讀取時不加鎖，可能與正在記錄的一筆錯開，統計上可忽略。
+// ==========================================
+uint32_t stagePercentile(const StageHist& h, uint32_t permille) {
+  if (!h.count) return 0;
+  uint32_t target = ((uint64_t)h.count * permille + 999) / 1000;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < STAGE_BUCKETS; b++) {
+    seen += h.buckets[b];
+    if (seen >= target) {
+      uint32_t upper = b ? (1UL << b) - 1 : 0;
+      return upper < h.maxUs ? upper : h.maxUs;
+    }
+  }
+  return h.maxUs;
+}
+
+void publishStages(bool reset) {
+  static char buf[2048];   // 15 個階段全部取最大值約 1.7 KB
+  int len = snprintf(buf, sizeof(buf), "{\"cpu_mhz\":%u,\"stages\":[", (unsigned)stageCpuMhz);
+  for (int i = 0; i < STAGE_COUNT && len < (int)sizeof(buf); i++) {
+    StageHist h = stageHist[i];
+    if (h.gen != stageResetGen) h.count = 0; // 已要求歸零但該任務尚未再記錄
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "%s{\"name\":\"%s\",\"n\":%u,\"avg_us\":%u,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u}",
+                    i ? "," : "", stageNames[i], (unsigned)h.count,
+                    (unsigned)(h.count ? h.sumUs / h.count : 0),
+                    (unsigned)(h.count ? stagePercentile(h, 500) : 0),
+                    (unsigned)(h.count ? stagePercentile(h, 990) : 0),
+                    (unsigned)(h.count ? h.maxUs : 0));
+  }
+  if (len < (int)sizeof(buf)) len += snprintf(buf + len, sizeof(buf) - len, "]}");
+  publishRaw(topic_stages, (const uint8_t*)buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+  if (reset) stageResetGen = stageResetGen + 1;
+}
+
+// ==========================================
+//  [新增] 狀態保存 (NVS 延遲寫入)
+//  控制任務只更新 RAM 影子並標記 dirty，不碰 flash；
+//  網路任務在最後一次變更 persistDelayMs 後把整個結構一次寫成 blob。
+//  重新開機前 (ESP.restart) 由 shutdown handler 補寫。
+// ==========================================
+#define PERSIST_VERSION 1
+
+struct PersistedState {
+  uint8_t version;
+  uint8_t autoMode;
+  uint8_t pumpSoftAlarm;
+  int16_t fertDoneYday;     // 最後一次自動施肥的 tm_yday，-1 = 無
+  int16_t soilLow;
+  int16_t soilHigh;
+  uint32_t pumpRunMin;
+  uint32_t fertRunMin;
+};
+
+struct PersistStats {
+  uint32_t changes;         // 狀態改變次數 (舊版每次都會寫 flash)
+  uint32_t flashWrites;     // 實際寫入次數
+  uint32_t lastWriteUs;
+};
+
+PersistedState persisted;         // RAM 影子
+PersistedState persistedOnFlash;  // 最後一次寫入的內容，相同就不寫
+bool persistDirty = false;
+unsigned long persistDirtySince = 0;
+PersistStats persistStats = {};
+portMUX_TYPE persistMux = portMUX_INITIALIZER_UNLOCKED;
+SemaphoreHandle_t persistLock;    // 網路任務與重新開機路徑不同時寫 NVS
+
+void persistLoad() {
+  PersistedState st;
+  memset(&st, 0, sizeof(st));
+  if (prefs.getBytesLength("state") == sizeof(st) &&
+      prefs.getBytes("state", &st, sizeof(st)) == sizeof(st) && st.version == PERSIST_VERSION) {
+    // 正常讀到
+  } else {
+    // 舊版只存了個別的 key，轉換過來
+    st.version = PERSIST_VERSION;
+    st.autoMode = prefs.getBool("is_auto", true);
+    st.fertDoneYday = -1;
+    st.soilLow = prefs.getInt("soil_low", soilLow);
+    st.soilHigh = prefs.getInt("soil_high", soilHigh);
+  }
+  farm.restore(st.autoMode, st.pumpSoftAlarm, st.fertDoneYday, st.pumpRunMin, st.fertRunMin, millis());
+  farm.setThresholds(st.soilLow, st.soilHigh);
+  persisted = st;
+  persistedOnFlash = st;
+}
+
+// 控制任務每週期呼叫：只比對、更新 RAM
+void persistUpdate(unsigned long now) {
+  PersistedState cur;
+  memset(&cur, 0, sizeof(cur)); // 含填充位元組，memcmp 比對才可靠
+  cur.version = PERSIST_VERSION;
+  cur.autoMode = farm.autoMode();
+  cur.pumpSoftAlarm = farm.pumpSoftAlarm();
+  cur.fertDoneYday = farm.fertDoneYday();
+  cur.soilLow = farm.config().soilLow;
+  cur.soilHigh = farm.config().soilHigh;
+  cur.pumpRunMin = farm.pumpRunMin();
+  cur.fertRunMin = farm.fertRunMin();
+  if (memcmp(&cur, &persisted, sizeof(cur)) == 0) return;
+
+  portENTER_CRITICAL(&persistMux);
+  persisted = cur;
+  persistStats.changes++;
+  if (!persistDirty) { persistDirty = true; persistDirtySince = now; }
+  portEXIT_CRITICAL(&persistMux);
+}
+
+// 網路任務呼叫；force = 不等延遲立即寫 (重新開機前)
+void persistFlush(bool force) {
+  if (!persistDirty) return;
+  if (!force && millis() - persistDirtySince < persistDelayMs) return;
+  if (xSemaphoreTake(persistLock, pdMS_TO_TICKS(1000)) != pdTRUE) return;
+
+  PersistedState st;
+  portENTER_CRITICAL(&persistMux);
+  st = persisted;
+  persistDirty = false;
+  portEXIT_CRITICAL(&persistMux);
+
+  if (memcmp(&st, &persistedOnFlash, sizeof(st)) != 0) { // 改了又改回來就不必寫
+    uint32_t t0 = micros();
+    if (prefs.putBytes("state", &st, sizeof(st)) == sizeof(st)) {
+      persistedOnFlash = st;
+      persistStats.flashWrites++;
+      persistStats.lastWriteUs = micros() - t0;
+    } else {
+      portENTER_CRITICAL(&persistMux);
+      if (!persistDirty) { persistDirty = true; persistDirtySince = millis(); } // 稍後重試
+      portEXIT_CRITICAL(&persistMux);
+    }
+  }
+  xSemaphoreGive(persistLock);
+}
+
+void persistShutdownHandler() {
+  persistFlush(true);
+}
+
+// ==========================================
+//  [新增] 遙測歷史 (多解析度環形緩衝)
+//  原始 1 秒樣本 -> 每分鐘彙總 -> 每 15 分鐘彙總，各自一個固定大小的環。
+//  斷網或 broker 停機期間資料留在板子上，之後用 HISTORY 指令依時間範圍取回。
+//  只在網路任務存取 (取樣與查詢都在那裡)，不需要鎖。
+// ==========================================
+#define HIST_FIELDS 6   // temp, hum, soil_hum, soil_temp, ec, salinity
+
+struct HistSample {
+  uint32_t t;               // 開機後秒數
+  int16_t v[HIST_FIELDS];   // 溫濕度 x10，ec/salinity 原值
+  uint16_t status;
+};
+
+struct HistRollup {
+  uint32_t t;               // 區間起點 (開機後秒數)
+  uint16_t count;
+  uint16_t status;          // 區間內出現過的狀態位元 (OR)
+  int16_t vmin[HIST_FIELDS];
+  int16_t vavg[HIST_FIELDS];
+  int16_t vmax[HIST_FIELDS];
+};
+
+// 彙總中的區間 (總和用 32 位元，平均在關閉時才算)
+struct HistAccum {
+  uint32_t t;
+  uint16_t count;
+  uint16_t status;
+  int16_t vmin[HIST_FIELDS];
+  int16_t vmax[HIST_FIELDS];
+  int32_t sum[HIST_FIELDS];
+};
+
+template <typename T, size_t N>
+struct HistRing {
+  T* slots = nullptr;
+  uint16_t head = 0;        // 下一個寫入位置
+  uint16_t count = 0;
+
+  void push(const T& x) {
+    slots[head] = x;
+    head = (head + 1) % N;
+    if (count < N) count++;
+  }
+  // i = 0 為最舊的一筆
+  const T& at(uint16_t i) const { return slots[(head + N - count + i) % N]; }
+  static constexpr size_t bytes() { return sizeof(T) * N; }
+};
+
+struct History {
+  HistRing<HistSample, HISTORY_RAW_SLOTS> raw;
+  HistRing<HistRollup, HISTORY_MIN_SLOTS> minute;
+  HistRing<HistRollup, HISTORY_QTR_SLOTS> quarter;
+  HistAccum minAcc;
+  HistAccum qtrAcc;
+  bool inPsram;
+  size_t bytes;
+  int64_t epochOffset;      // 對時後：epoch = t + epochOffset；0 = 尚未對時
+};
+
+History history = {};
+
+bool historyBegin() {
+  const size_t total = decltype(history.raw)::bytes() + decltype(history.minute)::bytes() + decltype(history.quarter)::bytes();
+  uint8_t* mem = nullptr;
+  if (psramFound()) mem = (uint8_t*)ps_malloc(total);
+  history.inPsram = (mem != nullptr);
+  if (!mem) mem = (uint8_t*)malloc(total);
+  if (!mem) return false;
+  history.raw.slots = (HistSample*)mem;
+  history.minute.slots = (HistRollup*)(mem + decltype(history.raw)::bytes());
+  history.quarter.slots = (HistRollup*)(mem + decltype(history.raw)::bytes() + decltype(history.minute)::bytes());
+  history.bytes = total;
+  return true;
+}
+
+static void accumAdd(HistAccum& a, uint32_t t, const int16_t* v, int16_t const* vmin, int16_t const* vmax,
+                     uint16_t count, uint16_t status) {
+  if (a.count == 0) {
+    a.t = t;
+    a.status = 0;
+    for (int f = 0; f < HIST_FIELDS; f++) { a.vmin[f] = vmin[f]; a.vmax[f] = vmax[f]; a.sum[f] = 0; }
+  }
+  for (int f = 0; f < HIST_FIELDS; f++) {
+    if (vmin[f] < a.vmin[f]) a.vmin[f] = vmin[f];
+    if (vmax[f] > a.vmax[f]) a.vmax[f] = vmax[f];
+    a.sum[f] += (int32_t)v[f] * count;
+  }
+  a.count += count;
+  a.status |= status;
+}
+
+static HistRollup accumClose(HistAccum& a) {
+  HistRollup r;
+  r.t = a.t;
+  r.count = a.count;
+  r.status = a.status;
+  for (int f = 0; f < HIST_FIELDS; f++) {
+    r.vmin[f] = a.vmin[f];
+    r.vmax[f] = a.vmax[f];
+    r.vavg[f] = (int16_t)(a.sum[f] / (int32_t)a.count);
+  }
+  a.count = 0;
+  return r;
+}
+
+static int16_t histClamp(long v) { return v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : (int16_t)v); }
+
+// 每秒由網路任務呼叫一次
+void historyAdd(const FarmTelemetry& tel, uint32_t nowSec) {
+  if (!history.raw.slots) return;
+  HistSample s;
+  s.t = nowSec;
+  s.v[0] = histClamp(lroundf(tel.airTemp * 10));
+  s.v[1] = histClamp(lroundf(tel.airHum * 10));
+  s.v[2] = histClamp(lroundf(tel.soilHum * 10));
+  s.v[3] = histClamp(lroundf(tel.soilTemp * 10));
+  s.v[4] = histClamp(tel.ec);
+  s.v[5] = histClamp(tel.salinity);
+  s.status = tel.status;
+  history.raw.push(s);
+
+  // 分鐘邊界：關閉上一分鐘並併入 15 分鐘區間
+  if (history.minAcc.count && nowSec / 60 != history.minAcc.t / 60) {
+    HistRollup m = accumClose(history.minAcc);
+    history.minute.push(m);
+    if (history.qtrAcc.count && m.t / 900 != history.qtrAcc.t / 900) history.quarter.push(accumClose(history.qtrAcc));
+    accumAdd(history.qtrAcc, m.t, m.vavg, m.vmin, m.vmax, m.count, m.status);
+  }
+  accumAdd(history.minAcc, nowSec, s.v, s.v, s.v, 1, s.status);
+}
+
+// 把查詢的 epoch 秒轉成開機後秒數 (未對時則視為開機後秒數)
+static uint32_t historyToUptime(int64_t t) {
+  if (history.epochOffset == 0) return t < 0 ? 0 : (uint32_t)t;
+  int64_t up = t - history.epochOffset;
+  return up < 0 ? 0 : (up > UINT32_MAX ? UINT32_MAX : (uint32_t)up);
+}
+
+static int64_t historyToEpoch(uint32_t t) { return (int64_t)t + history.epochOffset; }
+
+// 依時間範圍發佈到 farm/history，每則最多 historyRowsPerMsg 筆，最後一則帶 "last":true
+// tier 0 = 原始 [t,temp,hum,soil_hum,soil_temp,ec,salinity,status]
+// tier 1/2 = 分鐘/15 分鐘 [t,n,status,min x6,avg x6,max x6]
+void historyQuery(uint8_t tier, int64_t from, int64_t to) {
+  uint32_t lo = historyToUptime(from), hi = historyToUptime(to);
+  uint16_t total = tier == 0 ? history.raw.count : (tier == 1 ? history.minute.count : history.quarter.count);
+  char buf[1024];
+  uint16_t seq = 0, rows = 0;
+  size_t len = 0;
+
+  auto header = [&]() {
+    len = snprintf(buf, sizeof(buf), "{\"tier\":%u,\"seq\":%u,\"synced\":%d,\"rows\":[",
+                   (unsigned)tier, (unsigned)seq++, history.epochOffset != 0);
+  };
+  auto flush = [&](bool last) {
+    len += snprintf(buf + len, sizeof(buf) - len, "],\"last\":%s}", last ? "true" : "false");
+    publishRaw(topic_history, (const uint8_t*)buf, len);
+    rows = 0;
+    len = 0;
+  };
+
+  for (uint16_t i = 0; i < total; i++) {
+    uint32_t t = tier == 0 ? history.raw.at(i).t : (tier == 1 ? history.minute.at(i).t : history.quarter.at(i).t);
+    if (t < lo || t > hi) continue;
+    if (len == 0) header();
+    if (rows) buf[len++] = ',';
+    if (tier == 0) {
+      const HistSample& s = history.raw.at(i);
+      len += snprintf(buf + len, sizeof(buf) - len, "[%lld,%d,%d,%d,%d,%d,%d,%u]",
+                      (long long)historyToEpoch(s.t), s.v[0], s.v[1], s.v[2], s.v[3], s.v[4], s.v[5], (unsigned)s.status);
+    } else {
+      const HistRollup& r = tier == 1 ? history.minute.at(i) : history.quarter.at(i);
+      len += snprintf(buf + len, sizeof(buf) - len, "[%lld,%u,%u", (long long)historyToEpoch(r.t), (unsigned)r.count, (unsigned)r.status);
+      for (int f = 0; f < HIST_FIELDS; f++) len += snprintf(buf + len, sizeof(buf) - len, ",%d", r.vmin[f]);
+      for (int f = 0; f < HIST_FIELDS; f++) len += snprintf(buf + len, sizeof(buf) - len, ",%d", r.vavg[f]);
+      for (int f = 0; f < HIST_FIELDS; f++) len += snprintf(buf + len, sizeof(buf) - len, ",%d", r.vmax[f]);
+      buf[len++] = ']';
+    }
+    rows++;
+    // 一筆彙總最長約 140 字元，剩餘空間不夠下一筆就先送出
+    if (rows >= historyRowsPerMsg || sizeof(buf) - len < 160) flush(false);
+  }
+  if (len == 0) header(); // 最後一則 (可能是空的) 告知查詢結束
+  flush(true);
+}
+
+// ==========================================
+//  [新增] 斷線暫存：flash 分割區環形日誌
+//  固定 32 bytes 一筆 (一個 sector 128 筆)，每筆有 CRC16；
+//  寫到新 sector 開頭時才抹除它 (最舊的資料被覆蓋)。
+//  讀取直接走 mmap 的指標，補送時從 flash 映射位址寫進 MQTT 封包，不另外複製。
+//  補送進度：批次送出後把最後一筆的 flags 位元組從 0xFF 寫成 0x00 (不必抹除)，
+//  開機時找最新一筆已補送的紀錄，之後的都是待補送。
+//  [修改] 標記所在的 sector 被抹除後就找不到補送位置 (已送過的會再送一次)，
+//  所以每次抹除前把補送進度 (seq) 備份到 NVS；抹除一個 sector 要寫滿 128 筆，NVS 很少寫入。
+// ==========================================
+#define FLASH_LOG_MAGIC 0xA55A
+#define FLASH_SECTOR 4096
+
+struct LogRecord {
+  uint16_t magic;
+  uint8_t flags;            // 0xFF = 未補送；0x00 = 此筆 (含之前) 已補送，不在 CRC 範圍內
+  uint8_t len;              // payload 長度
+  uint32_t seq;
+  uint32_t t;               // epoch 秒 (未對時為 0)
+  uint8_t payload[18];      // packTelemetry() 的內容
+  uint16_t crc;
+};
+static_assert(sizeof(LogRecord) == 32, "LogRecord 必須是 32 bytes");
+static_assert(TELEMETRY_BIN_SIZE <= sizeof(LogRecord::payload), "payload 放不下");
+
+struct FlashLogStats {
+  uint32_t written;
+  uint32_t replayed;
+  uint32_t dropped;         // 未補送就被覆蓋
+  uint32_t badRecords;      // 開機掃描時 CRC 不符
+  uint32_t batches;
+  uint32_t writeErrors;     // [新增] esp_partition_write 失敗次數 (未寫入的留在暫存，下次再寫)
+};
+
+struct FlashLog {
+  const esp_partition_t* part;
+  const LogRecord* map;     // mmap 後的唯讀指標
+  uint32_t slots;
+  uint32_t head;            // 下一筆寫入位置
+  uint32_t tail;            // 最舊的待補送位置
+  uint32_t pending;
+  uint32_t nextSeq;
+  bool haveAck;             // 已補送進度 (ackSeq 與之前的都送過)
+  uint32_t ackSeq;
+  uint32_t ackSaved;        // NVS 裡的備份
+  LogRecord stage[FLASH_LOG_STAGE];
+  uint8_t staged;
+  unsigned long firstStagedMs;
+  bool writeFailed;         // [新增] 上次 flush 寫入失敗，暫存等 flashLogFlushMs 後再重試
+  FlashLogStats stats;
+};
+
+FlashLog flashLog = {};
+const uint32_t logPerSector = FLASH_SECTOR / sizeof(LogRecord);
+
+static uint16_t logRecordCrc(const LogRecord& r) {
+  LogRecord tmp = r;
+  tmp.flags = 0xFF;
+  return modbusCrc16((const uint8_t*)&tmp, offsetof(LogRecord, crc));
+}
+
+static bool logRecordValid(const LogRecord& r) {
+  return r.magic == FLASH_LOG_MAGIC && r.len <= sizeof(r.payload) && r.crc == logRecordCrc(r);
+}
+
+bool flashLogBegin() {
+  FlashLog& L = flashLog;
+  L.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "tlog");
+#if FLASH_LOG_USE_SPIFFS
+  if (!L.part) L.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "spiffs");
+#endif
+  if (!L.part) return false;
+
+  L.slots = (L.part->size / FLASH_SECTOR) * logPerSector;
+  const void* ptr;
+  esp_partition_mmap_handle_t handle;
+  if (L.slots == 0 || esp_partition_mmap(L.part, 0, L.slots * sizeof(LogRecord), ESP_PARTITION_MMAP_DATA, &ptr, &handle) != ESP_OK) {
+    L.part = nullptr;
+    return false;
+  }
+  L.map = (const LogRecord*)ptr;
+
+  // 掃描：最大 seq 的下一格為 head；最新一筆已補送之後的都是待補送
+  bool any = false;
+  uint32_t maxSeq = 0, maxSlot = 0, replayedSeq = 0;
+  bool anyReplayed = false;
+  for (uint32_t i = 0; i < L.slots; i++) {
+    const LogRecord& r = L.map[i];
+    if (r.magic == 0xFFFF) continue;       // 已抹除
+    if (!logRecordValid(r)) { L.stats.badRecords++; continue; }
+    if (!any || (int32_t)(r.seq - maxSeq) > 0) { maxSeq = r.seq; maxSlot = i; any = true; }
+    if (r.flags == 0x00 && (!anyReplayed || (int32_t)(r.seq - replayedSeq) > 0)) { replayedSeq = r.seq; anyReplayed = true; }
+  }
+  // [修改] flash 上的標記與 NVS 備份取較新的
+  if (prefs.isKey("tlog_ack")) {
+    uint32_t saved = prefs.getUInt("tlog_ack", 0);
+    if (!anyReplayed || (int32_t)(saved - replayedSeq) > 0) { replayedSeq = saved; anyReplayed = true; }
+    L.ackSaved = saved;
+  }
+  L.haveAck = anyReplayed;
+  L.ackSeq = replayedSeq;
+  if (!any) {
+    L.head = L.tail = 0;
+    L.nextSeq = anyReplayed ? replayedSeq + 1 : 1; // 新紀錄的 seq 不能落在已補送的範圍內
+    return true;
+  }
+  L.head = (maxSlot + 1) % L.slots;
+  L.nextSeq = (anyReplayed && (int32_t)(replayedSeq - maxSeq) > 0) ? replayedSeq + 1 : maxSeq + 1;
+  uint32_t firstSeq = anyReplayed ? replayedSeq + 1 : 0;
+  // 從最新一筆往回數，直到遇到已補送、無效或 seq 不連續的紀錄
+  uint32_t slot = maxSlot;
+  uint32_t expectSeq = maxSeq;
+  while (L.pending < L.slots) {
+    const LogRecord& r = L.map[slot];
+    if (!logRecordValid(r) || r.seq != expectSeq || r.flags == 0x00) break;
+    if (anyReplayed && (int32_t)(r.seq - firstSeq) < 0) break;
+    L.pending++;
+    expectSeq--;
+    slot = (slot + L.slots - 1) % L.slots;
+  }
+  L.tail = (L.head + L.slots - L.pending) % L.slots;
+  return true;
+}
+
+// 補送進度備份到 NVS (與狀態保存共用 prefs，要拿同一把鎖)
+static void flashLogSaveAck() {
+  FlashLog& L = flashLog;
+  if (!L.haveAck || L.ackSeq == L.ackSaved) return;
+  if (xSemaphoreTake(persistLock, pdMS_TO_TICKS(1000)) != pdTRUE) return;
+  if (prefs.putUInt("tlog_ack", L.ackSeq) == sizeof(uint32_t)) L.ackSaved = L.ackSeq;
+  xSemaphoreGive(persistLock);
+}
+
+static void flashLogErase(uint32_t sector) {
+  FlashLog& L = flashLog;
+  flashLogSaveAck();        // 這個 sector 可能有最新的已補送標記
+  // 要覆蓋的 sector 若還有待補送的資料，只能放棄
+  while (L.pending && L.tail / logPerSector == sector) {
+    L.tail = (L.tail + 1) % L.slots;
+    L.pending--;
+    L.stats.dropped++;
+  }
+  esp_partition_erase_range(L.part, sector * FLASH_SECTOR, FLASH_SECTOR);
+}
+
+// 把 RAM 暫存一次寫入 (每個 sector 內連續寫，跨 sector 前先抹除)
+// [修改] 寫入失敗時未寫入的部分留在暫存，下次 flush 重試 (原本整批丟掉且沒有計入 dropped)
+void flashLogFlush() {
+  FlashLog& L = flashLog;
+  uint8_t i = 0;
+  while (i < L.staged) {
+    if (L.head % logPerSector == 0) flashLogErase(L.head / logPerSector);
+    uint32_t room = logPerSector - L.head % logPerSector;
+    uint32_t n = min((uint32_t)(L.staged - i), room);
+    if (esp_partition_write(L.part, L.head * sizeof(LogRecord), &L.stage[i], n * sizeof(LogRecord)) != ESP_OK) {
+      L.stats.writeErrors++;
+      L.writeFailed = true;
+      break;
+    }
+    if (L.pending == 0) L.tail = L.head;
+    L.head = (L.head + n) % L.slots;
+    L.pending += n;
+    L.stats.written += n;
+    i += n;
+  }
+  if (i == L.staged) L.writeFailed = false;
+  else memmove(&L.stage[0], &L.stage[i], (L.staged - i) * sizeof(LogRecord));
+  L.staged -= i;
+  if (L.staged) L.firstStagedMs = millis();  // 重試的計時從現在開始
+}
+
+// 斷線時由網路任務呼叫
+void flashLogAppend(const FarmTelemetry& t, uint32_t epoch) {
+  FlashLog& L = flashLog;
+  if (!L.part) return;
+  // [新增] flash 一直寫不進去時暫存會滿：丟掉最舊的一筆並計入 dropped
+  if (L.staged >= FLASH_LOG_STAGE) {
+    memmove(&L.stage[0], &L.stage[1], (FLASH_LOG_STAGE - 1) * sizeof(LogRecord));
+    L.staged--;
+    L.stats.dropped++;
+  }
+  LogRecord& r = L.stage[L.staged];
+  memset(&r, 0xFF, sizeof(r));
+  r.magic = FLASH_LOG_MAGIC;
+  r.seq = L.nextSeq++;
+  r.t = epoch;
+  r.len = packTelemetry(t, r.payload);
+  r.crc = logRecordCrc(r);
+  if (L.staged++ == 0) L.firstStagedMs = millis();
+  if (L.staged >= FLASH_LOG_STAGE) flashLogFlush();
+}
+
+// 連線時由網路任務呼叫：每 flashReplayGapMs 最多送一批
+// 訊息格式：[版本=1][筆數] 之後每筆 [t uint32 LE][packTelemetry 內容]
+void flashLogReplay() {
+  FlashLog& L = flashLog;
+  static unsigned long lastBatch = 0;
+  if (!L.part) return;
+  // 剛恢復連線，先把暫存寫下去再依序補送 (上次寫入失敗的話照 flashLogFlushMs 重試)
+  if (L.staged && (!L.writeFailed || millis() - L.firstStagedMs >= flashLogFlushMs)) flashLogFlush();
+  if (L.pending == 0 || millis() - lastBatch < flashReplayGapMs) return;
+  lastBatch = millis();
+
+  // 一批不跨過環的尾端，方便直接從映射位址連續讀
+  uint32_t n = min(L.pending, (uint32_t)FLASH_REPLAY_BATCH);
+  n = min(n, L.slots - L.tail);
+  uint8_t valid = 0;
+  uint32_t lastValid = 0;
+  size_t len = 2;
+  for (uint32_t i = 0; i < n; i++) {
+    const LogRecord& r = L.map[L.tail + i];
+    if (logRecordValid(r)) { valid++; lastValid = i; len += 4 + r.len; }
+  }
+
+  if (valid) {
+    uint8_t hdr[2] = { 1, valid };
+    if (!client.beginPublish(topic_backlog, len, false)) return;
+    client.write(hdr, 2);
+    for (uint32_t i = 0; i < n; i++) {
+      const LogRecord& r = L.map[L.tail + i];
+      if (logRecordValid(r)) client.write((const uint8_t*)&r.t, 4 + r.len); // t 與 payload 在 flash 上相鄰
+    }
+    if (client.endPublish() != 1) return;  // 沒送成功，下次重送同一批
+
+    uint8_t done = 0x00;
+    esp_partition_write(L.part, (L.tail + lastValid) * sizeof(LogRecord) + offsetof(LogRecord, flags), &done, 1);
+    L.haveAck = true;
+    L.ackSeq = L.map[L.tail + lastValid].seq;
+  }
+
+  L.tail = (L.tail + n) % L.slots;
+  L.pending -= n;
+  L.stats.replayed += valid;
+  L.stats.batches++;
+}
+
+// ==========================================
+//  [新增] MQTT 指令解析 (直接在 payload 上處理，不配置記憶體)
+//  指令名稱在編譯期算成 FNV-1a 雜湊後用 switch 分派；
+//  case 值重複會編譯失敗，等於保證這組名稱沒有碰撞。
+//  支援舊的純文字指令 (STOP、LED1_ON ...) 與帶參數的 JSON：
+//    {"cmd":"PUMP_RUN","sec":120}
+//    {"cmd":"SET","soil_low":25,"soil_high":75}
+//    {"cmd":"VALVE","id":3,"on":true}
+// ==========================================
+constexpr uint32_t cmdHash(const char* s, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) { h ^= (uint8_t)s[i]; h *= 16777619u; }
+  return h;
+}
+constexpr uint32_t operator"" _cmd(const char* s, size_t n) { return cmdHash(s, n); }
+
+struct Span {
+  const char* p;
+  size_t n;
+};
+
+bool spanEq(Span a, const char* lit) {
+  size_t n = strlen(lit);
+  return a.n == n && memcmp(a.p, lit, n) == 0;
+}
+
+// [修改] 超出 int32_t 範圍視為格式錯誤 (原本會溢位成其他數值)
+bool spanToInt(Span a, int32_t& out) {
+  if (a.n == 0 || a.n > 11) return false;
+  if (spanEq(a, "true"))  { out = 1; return true; }
+  if (spanEq(a, "false")) { out = 0; return true; }
+  size_t i = 0;
+  bool neg = (a.p[0] == '-');
+  if (neg) i++;
+  if (i == a.n) return false;
+  const uint32_t limit = neg ? 2147483648u : 2147483647u;
+  uint32_t v = 0;
+  for (; i < a.n; i++) {
+    if (a.p[i] < '0' || a.p[i] > '9') return false;
+    uint32_t d = a.p[i] - '0';
+    if (v > (limit - d) / 10) return false;
+    v = v * 10 + d;
+  }
+  out = neg ? (int32_t)(0u - v) : (int32_t)v;
+  return true;
+}
+
+Span trimSpan(Span a) {
+  while (a.n && isspace((uint8_t)a.p[0])) { a.p++; a.n--; }
+  while (a.n && isspace((uint8_t)a.p[a.n - 1])) a.n--;
+  return a;
+}
+
+// 讀下一組 "key": value (平面物件，值為字串/數字/true/false)
+bool jsonNextPair(const char*& p, const char* end, Span& key, Span& val) {
+  while (p < end && *p != '"') p++;
+  if (p >= end) return false;
+  key.p = ++p;
+  while (p < end && *p != '"') p++;
+  if (p >= end) return false;
+  key.n = p - key.p;
+  p++;
+  while (p < end && (*p == ':' || isspace((uint8_t)*p))) p++;
+  if (p >= end) return false;
+  if (*p == '"') {
+    val.p = ++p;
+    while (p < end && *p != '"') p++;
+    if (p >= end) return false;
+    val.n = p - val.p;
+    p++;
+  } else {
+    val.p = p;
+    while (p < end && *p != ',' && *p != '}' && !isspace((uint8_t)*p)) p++;
+    val.n = p - val.p;
+  }
+  return true;
+}
+
+enum CmdToken : uint8_t {
+  TOK_UNKNOWN, TOK_STOP, TOK_AUTO_ON, TOK_AUTO_OFF,
+  TOK_PUMP_ON, TOK_PUMP_OFF, TOK_FERT_ON, TOK_FERT_OFF,
+  TOK_PUMP_RUN, TOK_SET, TOK_VALVE, TOK_BENCH_CRC, TOK_BENCH_JSON,
+  TOK_HISTORY, TOK_STAGES, TOK_BENCH_PARSE, TOK_SIM, TOK_BENCH_TICK,
+  TOK_BAD_ARG               // [新增] 指令名稱正確以外的參數格式錯誤或溢位
+};
+
+// 雜湊命中後再比一次字串，未知指令碰巧同雜湊也不會誤判
+CmdToken lookupCmd(Span name) {
+  const char* expect;
+  CmdToken tok;
+  switch (cmdHash(name.p, name.n)) {
+    case "STOP"_cmd:       expect = "STOP";       tok = TOK_STOP;       break;
+    case "AUTO_ON"_cmd:    expect = "AUTO_ON";    tok = TOK_AUTO_ON;    break;
+    case "AUTO_OFF"_cmd:   expect = "AUTO_OFF";   tok = TOK_AUTO_OFF;   break;
+    case "LED1_ON"_cmd:    expect = "LED1_ON";    tok = TOK_PUMP_ON;    break;
+    case "LED1_OFF"_cmd:   expect = "LED1_OFF";   tok = TOK_PUMP_OFF;   break;
+    case "LED2_ON"_cmd:    expect = "LED2_ON";    tok = TOK_FERT_ON;    break;
+    case "LED2_OFF"_cmd:   expect = "LED2_OFF";   tok = TOK_FERT_OFF;   break;
+    case "PUMP_RUN"_cmd:   expect = "PUMP_RUN";   tok = TOK_PUMP_RUN;   break;
+    case "SET"_cmd:        expect = "SET";        tok = TOK_SET;        break;
+    case "VALVE"_cmd:      expect = "VALVE";      tok = TOK_VALVE;      break;
+    case "BENCH_CRC"_cmd:  expect = "BENCH_CRC";  tok = TOK_BENCH_CRC;  break;
+    case "BENCH_JSON"_cmd: expect = "BENCH_JSON"; tok = TOK_BENCH_JSON; break;
+    case "HISTORY"_cmd:    expect = "HISTORY";    tok = TOK_HISTORY;    break;
+    case "STAGES"_cmd:     expect = "STAGES";     tok = TOK_STAGES;     break;
+    case "BENCH_PARSE"_cmd: expect = "BENCH_PARSE"; tok = TOK_BENCH_PARSE; break;
+    case "SIM"_cmd:        expect = "SIM";        tok = TOK_SIM;        break;
+    case "BENCH_TICK"_cmd: expect = "BENCH_TICK"; tok = TOK_BENCH_TICK; break;
+    default: return TOK_UNKNOWN;
+  }
+  return spanEq(name, expect) ? tok : TOK_UNKNOWN;
+}
+
+// JSON 指令的參數，-1 代表沒有給
+struct CmdArgs {
+  int32_t sec = -1;
+  int32_t id = -1;
+  int32_t on = -1;
+  int32_t soilLow = -1;
+  int32_t soilHigh = -1;
+  int32_t tier = -1;        // HISTORY：0 原始 / 1 分鐘 / 2 十五分鐘
+  int32_t from = -1;        //          epoch 秒 (未對時則為開機後秒數)
+  int32_t to = -1;
+  int32_t last = -1;        //          或最近 N 秒
+  int32_t reset = -1;       // STAGES：1 = 發佈後歸零
+  int32_t days = -1;        // SIM：模擬天數
+  int32_t wet = -1;         //      水泵每分鐘使土壤濕度上升幾 %
+  int32_t tripMin = -1;     //      積熱電驛跳脫前可連續運轉的分鐘數
+};
+
+// [修改] 解析一則指令但不執行 (回調與 BENCH_PARSE 共用)；未知指令回傳 TOK_UNKNOWN，
+//        參數不是整數或超出 int32_t 回傳 TOK_BAD_ARG
+CmdToken parseCommand(Span msg, CmdArgs& args) {
+  Span name = msg;
+  if (msg.n && msg.p[0] == '{') {
+    // JSON 指令
+    name.n = 0;
+    const char* p = msg.p;
+    const char* end = msg.p + msg.n;
+    Span key, val;
+    while (jsonNextPair(p, end, key, val)) {
+      int32_t* slot = nullptr;
+      switch (cmdHash(key.p, key.n)) {
+        case "cmd"_cmd:       if (spanEq(key, "cmd")) name = val; break;
+        case "sec"_cmd:       if (spanEq(key, "sec")) slot = &args.sec; break;
+        case "id"_cmd:        if (spanEq(key, "id")) slot = &args.id; break;
+        case "on"_cmd:        if (spanEq(key, "on")) slot = &args.on; break;
+        case "soil_low"_cmd:  if (spanEq(key, "soil_low")) slot = &args.soilLow; break;
+        case "soil_high"_cmd: if (spanEq(key, "soil_high")) slot = &args.soilHigh; break;
+        case "tier"_cmd:      if (spanEq(key, "tier")) slot = &args.tier; break;
+        case "from"_cmd:      if (spanEq(key, "from")) slot = &args.from; break;
+        case "to"_cmd:        if (spanEq(key, "to")) slot = &args.to; break;
+        case "last"_cmd:      if (spanEq(key, "last")) slot = &args.last; break;
+        case "reset"_cmd:     if (spanEq(key, "reset")) slot = &args.reset; break;
+        case "days"_cmd:      if (spanEq(key, "days")) slot = &args.days; break;
+        case "wet"_cmd:       if (spanEq(key, "wet")) slot = &args.wet; break;
+        case "trip_min"_cmd:  if (spanEq(key, "trip_min")) slot = &args.tripMin; break;
+      }
+      if (slot && !spanToInt(val, *slot)) return TOK_BAD_ARG;
+    }
+  } else if (msg.n > 5 && memcmp(msg.p, "VALVE", 5) == 0 && isdigit((uint8_t)msg.p[5])) {
+    // 舊格式 VALVE<n>_ON / VALVE<n>_OFF (RS485 繼電器板)
+    size_t i = 5;
+    while (i < msg.n && isdigit((uint8_t)msg.p[i])) i++;
+    Span suffix = { msg.p + i, msg.n - i };
+    if (spanEq(suffix, "_ON")) args.on = 1;
+    else if (spanEq(suffix, "_OFF")) args.on = 0;
+    else return TOK_UNKNOWN;
+    if (!spanToInt({ msg.p + 5, i - 5 }, args.id)) return TOK_BAD_ARG;
+    name = { msg.p, 5 };
+  }
+  return lookupCmd(name);
+}
+
+// ==========================================
+//  [新增] 解析效能量測 (MQTT 指令 BENCH_PARSE，結果發佈到 farm/metrics)
+//  指令解析與 RS485 土壤回應解碼都是純函式，用固定的輸入在裝置上重複執行，
+//  每次結果可直接比較。控制週期本身的實際耗時另見 STAGES 的 ctl_cycle。
+// ==========================================
+void runParseBenchmark() {
+  // 土壤解碼要用第一個探頭的設定 (型號、區塊)；沒有探頭時不量，回報錯誤
+  if (soilProbeCount == 0 || soilProbes[0].cfg.model == nullptr || soilProbes[0].blockCount == 0) {
+    client.publish(topic_metrics, "{\"bench\":\"parse\",\"error\":\"no_probe\"}");
+    return;
+  }
+  const int iterations = 1000;
+  static const char* const samples[] = {
+    "AUTO_ON",
+    "VALVE3_OFF",
+    "{\"cmd\":\"PUMP_RUN\",\"sec\":120}",
+    "{\"cmd\":\"SET\",\"soil_low\":25,\"soil_high\":75}",
+    "{\"cmd\":\"HISTORY\",\"tier\":1,\"from\":1700000000,\"to\":1700003600}",
+  };
+  const int sampleCount = sizeof(samples) / sizeof(samples[0]);
+  volatile uint32_t sink = 0;
+
+  uint32_t t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) {
+    const char* p = samples[i % sampleCount];
+    CmdArgs args;
+    sink += parseCommand({ p, strlen(p) }, args);
+  }
+  uint32_t cmdCycles = ESP.getCycleCount() - t0;
+
+  // 以第一個探頭的第一個區塊組一筆合法回應 (含 CRC)，解碼到複本，不動到實際數值
+  static SoilProbe probe;
+  probe = soilProbes[0];
+  const SoilReadBlock& b = probe.blocks[0];
+  static uint8_t reply[MB_MAX_FRAME];
+  size_t len = 5 + 2 * (size_t)b.count;
+  reply[0] = probe.cfg.addr; reply[1] = 0x03; reply[2] = 2 * b.count;
+  for (size_t i = 3; i < len - 2; i++) reply[i] = (uint8_t)(i * 29 + 7);
+  uint16_t crc = modbusCrc16(reply, len - 2);
+  reply[len - 2] = crc & 0xFF;
+  reply[len - 1] = crc >> 8;
+
+  bool soilOk = true;
+  t0 = ESP.getCycleCount();
+  for (int i = 0; i < iterations; i++) {
+    soilOk &= modbusCrc16(reply, len - 2) == crc;   // 與 ModbusMaster::validate() 相同的 CRC 檢查
+    soilOk &= parseSoilBlock(probe, b, reply, len);
+  }
+  uint32_t soilCycles = ESP.getCycleCount() - t0;
+
+  const StageHist& ctl = stageHist[STAGE_CTL_CYCLE];
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  char out[224];
+  snprintf(out, sizeof(out),
+           "{\"bench\":\"parse\",\"samples\":%d,\"cmd_ns\":%u,\"soil_ns\":%u,\"soil_bytes\":%u,\"soil_ok\":%d"
+           ",\"ctl_cycle_avg_us\":%u,\"ctl_cycle_max_us\":%u}",
+           iterations, (unsigned)((uint64_t)cmdCycles * 1000 / mhz / iterations),
+           (unsigned)((uint64_t)soilCycles * 1000 / mhz / iterations), (unsigned)len, soilOk ? 1 : 0,
+           (unsigned)(ctl.count ? ctl.sumUs / ctl.count : 0), (unsigned)ctl.maxUs);
+  client.publish(topic_metrics, out);
+}
+
+// [新增] 拒絕指令：序列埠記錄，並回覆原因到 farm/metrics (遠端才知道指令沒有被執行)
+void rejectCommand(const char* reason, const char* why) {
+  Serial.println(why);
+  char out[64];
+  snprintf(out, sizeof(out), "{\"cmd_error\":\"%s\"}", reason);
+  client.publish(topic_metrics, out);
+}
+
+// 閥門編號依序排在各繼電器板的線圈之後，總數即可用的閥門數
+uint16_t valveCount() {
+  uint16_t n = 0;
+  for (uint8_t i = 0; i < relayBoardCount; i++) n += relayBoards[i].cfg.coils;
+  return n;
+}
+
+// ==========================================
+//  MQTT 回調函式 (網路任務)
+//  只負責解析，實際動作交給控制任務執行
+// ==========================================
+void callback(char* topic, byte* payload, unsigned int length) {
+  Span msg = trimSpan({ (const char*)payload, length });
+  Serial.printf("收到 MQTT: %.*s\n", (int)msg.n, msg.p);
+
+  CmdArgs args;
+  FarmCmd cmd = {};
+  switch (parseCommand(msg, args)) {
+    case TOK_STOP:     cmd.type = CMD_STOP;     break;
+    case TOK_AUTO_ON:  cmd.type = CMD_AUTO_ON;  break;
+    case TOK_AUTO_OFF: cmd.type = CMD_AUTO_OFF; break;
+    case TOK_PUMP_ON:  cmd.type = CMD_PUMP_ON;  break;
+    case TOK_PUMP_OFF: cmd.type = CMD_PUMP_OFF; break;
+    case TOK_FERT_ON:  cmd.type = CMD_FERT_ON;  break;
+    case TOK_FERT_OFF: cmd.type = CMD_FERT_OFF; break;
+    case TOK_PUMP_RUN:
+      // 最長不超過 pumpMaxRunTime (超時保護仍然有效)
+      if (args.sec <= 0 || args.sec > pumpMaxRunTime * 60) { rejectCommand("pump_run_sec", "PUMP_RUN 秒數超出範圍"); return; }
+      cmd.type = CMD_PUMP_RUN;
+      cmd.arg = args.sec;
+      break;
+    case TOK_SET:
+      if (args.soilLow < 0 || args.soilHigh > 100 || args.soilLow >= args.soilHigh) { rejectCommand("set_soil", "SET 設定值不合理"); return; }
+      cmd.type = CMD_SET_SOIL;
+      cmd.arg = args.soilLow;
+      cmd.arg2 = args.soilHigh;
+      break;
+    case TOK_VALVE:
+      // [修改] 編號要對得到繼電器板上的線圈 (FarmCmd.arg 只有 16 位元，不能直接截斷)
+      if (args.on < 0) { rejectCommand("valve_args", "VALVE 缺少 on"); return; }
+      if (args.id < 0 || args.id >= valveCount()) { rejectCommand("valve_id", "閥門編號超出範圍"); return; }
+      cmd.type = args.on ? CMD_VALVE_ON : CMD_VALVE_OFF;
+      cmd.arg = args.id;
+      break;
+    case TOK_BENCH_CRC:  runCrcBenchmark(); return;       // 在網路任務執行，不影響控制核心
+    case TOK_BENCH_JSON: runTelemetryBenchmark(); return;
+    case TOK_BENCH_PARSE: runParseBenchmark(); return;
+    case TOK_BENCH_TICK: runTickBenchmark(); return;
+    case TOK_SIM: {
+      // {"cmd":"SIM","days":30,"wet":8,"trip_min":0}，結果發佈到 farm/sim
+      int32_t days = args.days > 0 ? args.days : 30;
+      int32_t wet = args.wet > 0 ? args.wet : 8;
+      int32_t trip = args.tripMin >= 0 ? args.tripMin : 0;
+      if (days > SIM_MAX_DAYS || wet > 100 || trip > 255) { rejectCommand("sim_args", "SIM 參數超出範圍"); return; }
+      cmd.type = CMD_SIM;
+      cmd.arg = days;
+      cmd.arg2 = wet | (trip << 8);
+      break;
+    }
+    case TOK_STAGES:     publishStages(args.reset > 0); return; // STAGES 或 {"cmd":"STAGES","reset":1}
+    case TOK_HISTORY: {
+      // {"cmd":"HISTORY","tier":1,"last":3600} 或 {"cmd":"HISTORY","tier":2,"from":...,"to":...}
+      // 純文字 HISTORY = 最近 10 分鐘原始資料
+      uint8_t tier = args.tier >= 0 && args.tier <= 2 ? args.tier : 0;
+      int64_t now = historyToEpoch(millis() / 1000);
+      int64_t from = args.from >= 0 ? args.from : now - (args.last > 0 ? args.last : 600);
+      int64_t to = args.to >= 0 ? args.to : now;
+      historyQuery(tier, from, to);
+      return;
+    }
+    case TOK_BAD_ARG: rejectCommand("bad_arg", "指令參數格式錯誤或超出範圍"); return;
+    default: return;
+  }
+
+  xQueueSend(cmdQueue, &cmd, 0);
+}
+
+// ==========================================
+//  [新增] 控制任務端執行指令 (原 callback 內的動作)
+// ==========================================
+void applyCommand(const FarmCmd& cmd, unsigned long currentMillis) {
+  switch (cmd.type) {
+    case CMD_VALVE_ON:
+    case CMD_VALVE_OFF:
+      setValve(cmd.arg, cmd.type == CMD_VALVE_ON);
+      break;
+    case CMD_SIM:
+      // [修改] 模擬在自己的任務與控制器上跑，實際控制照常運作；同時只能跑一個
+      if (sim.active || sim.pending || sim.finished) {
+          raiseAlert("⚠️ [模擬] 上一個模擬尚未結束");
+          break;
+      }
+      sim.days = cmd.arg;
+      sim.wetPerMin = cmd.arg2 & 0xFF;
+      sim.tripMin = cmd.arg2 >> 8;
+      sim.cfg = farm.config();
+      portENTER_CRITICAL(&simMux);
+      sim.pending = true;
+      portEXIT_CRITICAL(&simMux);
+      if (simTaskHandle != NULL) xTaskNotifyGive(simTaskHandle);
+      break;
+    default:
+      farm.command(cmd, currentMillis); // [修改] 水泵 / 施肥機 / 模式交給控制器
+      break;
+  }
+}
+
+bool reconnectMQTT() {
+  if (!client.connected()) {
+    String clientId = "ESP32-" + String(random(0xffff), HEX);
+    if (client.connect(clientId.c_str(), mqtt_user, mqtt_password)) {
+      client.subscribe(topic_control);
+      telemetrySentOnce = false; // 重連後馬上補送一筆完整狀態
+      return true;
+    }
+    return false;
+  }
+  return true;
+}
+
+// ==========================================
+//  [新增] 連線管理 (只在網路任務執行)
+//  WiFi 狀態由事件回調更新 (不輪詢、不 delay)；自動重連關掉，
+//  改由這裡在每次失敗事件後依指數退避 + 隨機抖動重試，
+//  多台設備同時斷線時不會一起擠回 AP / broker。
+//  MQTT connect 本身仍會阻塞網路任務 (最多約 socket 逾時)，
+//  但控制任務在另一個核心，不受影響。
+// ==========================================
+struct ConnManager {
+  volatile bool wifiUp;               // 事件回調寫入
+  volatile uint32_t wifiDownEvents;   // 斷線/連線失敗事件次數
+  volatile uint8_t lastReason;        // 最近一次斷線原因 (wifi_err_reason_t)
+  bool wasUp;
+  uint32_t seenDownEvents;
+  unsigned long wifiDownSince;
+  unsigned long nextWifiAttempt;
+  unsigned long lastWifiAttempt;
+  uint32_t wifiBackoffMs;
+  bool wifiEverUp;                    // 第一次連上不算重連
+  bool mqttEverUp;
+  bool mqttUp;
+  unsigned long mqttDownSince;
+  unsigned long nextMqttAttempt;
+  uint32_t mqttBackoffMs;
+  // 統計
+  uint32_t wifiReconnects;
+  uint32_t wifiAttempts;
+  uint32_t wifiDownMs;                // 累計斷線時間 (不含目前這次)
+  uint32_t mqttReconnects;
+  uint32_t mqttAttempts;
+  uint32_t mqttDownMs;
+  uint32_t lastMqttConnectMs;         // 最近一次 connect() 佔用網路任務的時間
+  uint32_t maxMqttConnectMs;
+};
+ConnManager conn = {};
+
+static uint32_t withJitter(uint32_t ms) {
+  return ms - ms / 4 + esp_random() % (ms / 2 + 1); // ±25%
+}
+
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    conn.wifiUp = true;
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_LOST_IP) {
+    conn.wifiUp = false;
+    if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) conn.lastReason = info.wifi_sta_disconnected.reason;
+    conn.wifiDownEvents++;
+  }
+  if (netTaskHandle != NULL) xTaskNotifyGive(netTaskHandle);
+}
+
+void connBegin() {
+  conn.wifiDownSince = millis();
+  conn.mqttDownSince = millis();
+  conn.wifiBackoffMs = connBackoffBaseMs;
+  conn.mqttBackoffMs = connBackoffBaseMs;
+  conn.lastWifiAttempt = millis();
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+  WiFi.onEvent(onWiFiEvent);
+  WiFi.begin(ssid, password); // 立即返回，結果由事件通知
+}
+
+// 網路任務每輪呼叫，回傳 MQTT 是否可用
+bool connTick() {
+  unsigned long now = millis();
+  bool up = conn.wifiUp;
+
+  if (up != conn.wasUp) {
+    conn.wasUp = up;
+    if (up) {
+      conn.wifiDownMs += now - conn.wifiDownSince;
+      if (conn.wifiEverUp) conn.wifiReconnects++;
+      conn.wifiEverUp = true;
+      conn.wifiBackoffMs = connBackoffBaseMs;
+      conn.nextMqttAttempt = now;     // WiFi 一回來就試 MQTT
+    } else {
+      conn.wifiDownSince = now;
+    }
+  }
+
+  if (!up) {
+    // 每收到一次失敗事件就排下一次重試；完全沒事件則視為卡住
+    if (conn.wifiDownEvents != conn.seenDownEvents) {
+      conn.seenDownEvents = conn.wifiDownEvents;
+      conn.nextWifiAttempt = now + withJitter(conn.wifiBackoffMs);
+      conn.wifiBackoffMs = min(conn.wifiBackoffMs * 2, connBackoffMaxMs);
+    } else if (now - conn.lastWifiAttempt >= wifiStallMs && (long)(now - conn.nextWifiAttempt) >= 0) {
+      conn.nextWifiAttempt = now;
+    }
+    if (conn.nextWifiAttempt && (long)(now - conn.nextWifiAttempt) >= 0) {
+      conn.nextWifiAttempt = 0;
+      conn.lastWifiAttempt = now;
+      conn.wifiAttempts++;
+      WiFi.reconnect();
+    }
+  }
+
+  bool mqttUp = up && client.connected();
+  if (conn.mqttUp && !mqttUp) {
+    conn.mqttUp = false;
+    conn.mqttDownSince = now;
+  }
+  if (up && !mqttUp && (long)(now - conn.nextMqttAttempt) >= 0) {
+    conn.mqttAttempts++;
+    unsigned long t0 = millis();
+    mqttUp = reconnectMQTT();
+    conn.lastMqttConnectMs = millis() - t0;
+    if (conn.lastMqttConnectMs > conn.maxMqttConnectMs) conn.maxMqttConnectMs = conn.lastMqttConnectMs;
+    if (mqttUp) {
+      conn.mqttUp = true;
+      if (conn.mqttEverUp) conn.mqttReconnects++;
+      conn.mqttEverUp = true;
+      conn.mqttDownMs += millis() - conn.mqttDownSince;
+      conn.mqttBackoffMs = connBackoffBaseMs;
+    } else {
+      conn.nextMqttAttempt = millis() + withJitter(conn.mqttBackoffMs);
+      conn.mqttBackoffMs = min(conn.mqttBackoffMs * 2, connBackoffMaxMs);
+    }
+  }
+  return mqttUp;
+}
+
+// ==========================================
+//  [新增] 健康監控 (網路任務每 healthCheckMs 執行)
+//  追蹤可用 heap、最大連續區塊、開機以來最低 heap、各任務堆疊剩餘；
+//  只有連續 healthTripChecks 次超出門檻才要求重開機，
+//  由控制任務在水泵/施肥都停止時執行，原因先寫進 NVS，開機後回報。
+// ==========================================
+enum RestartCause : uint8_t { RESTART_NONE, RESTART_HEAP_LOW, RESTART_HEAP_FRAGMENTED, RESTART_STACK_LOW };
+
+struct RestartRecord {
+  uint8_t cause;            // RestartCause
+  char task[15];            // 堆疊不足的任務名稱
+  uint32_t freeHeap;
+  uint32_t largestBlock;
+  uint32_t minFreeHeap;
+  uint32_t stackFree;
+  uint32_t uptimeSec;
+};
+
+struct HealthState {
+  uint32_t freeHeap;
+  uint32_t largestBlock;
+  uint32_t minFreeHeap;
+  uint32_t stackFree[4];    // control, sensor, net, alert (bytes)
+  uint8_t badChecks;
+  volatile bool restartRequested;
+  unsigned long restartRequestedAt;
+  RestartRecord pending;    // 要重開機時寫入的內容
+  RestartRecord last;       // 上一次由健康監控觸發的重開機 (開機時讀回)
+  esp_reset_reason_t resetReason;
+};
+HealthState health = {};
+
+static const char* const healthTaskNames[4] = { "control", "sensor", "net", "alert" };
+
+const char* restartCauseName(uint8_t c) {
+  switch (c) {
+    case RESTART_HEAP_LOW:        return "heap_low";
+    case RESTART_HEAP_FRAGMENTED: return "heap_fragmented";
+    case RESTART_STACK_LOW:       return "stack_low";
+    default:                      return "none";
+  }
+}
+
+const char* resetReasonName(esp_reset_reason_t r) {
+  switch (r) {
+    case ESP_RST_POWERON:   return "power_on";
+    case ESP_RST_EXT:       return "external";
+    case ESP_RST_SW:        return "software";
+    case ESP_RST_PANIC:     return "panic";
+    case ESP_RST_INT_WDT:   return "int_wdt";
+    case ESP_RST_TASK_WDT:  return "task_wdt";
+    case ESP_RST_WDT:       return "wdt";
+    case ESP_RST_DEEPSLEEP: return "deep_sleep";
+    case ESP_RST_BROWNOUT:  return "brownout";
+    default:                return "unknown";
+  }
+}
+
+// 開機時讀回上次原因並清除，避免之後當機被誤認成同一個原因
+void healthBegin() {
+  health.resetReason = esp_reset_reason();
+  if (prefs.getBytesLength("restart") == sizeof(RestartRecord)) {
+    prefs.getBytes("restart", &health.last, sizeof(RestartRecord));
+    prefs.remove("restart");
+  }
+  if (health.resetReason != ESP_RST_SW) health.last.cause = RESTART_NONE; // 上次其實不是我們重開的
+}
+
+void healthCheck() {
+  HealthState& h = health;
+  h.freeHeap = ESP.getFreeHeap();
+  h.largestBlock = ESP.getMaxAllocHeap();
+  h.minFreeHeap = ESP.getMinFreeHeap();
+  TaskHandle_t tasks[4] = { controlTaskHandle, sensorTaskHandle, netTaskHandle, alertTaskHandle };
+  int lowStack = -1;
+  for (int i = 0; i < 4; i++) {
+    h.stackFree[i] = tasks[i] ? uxTaskGetStackHighWaterMark(tasks[i]) : 0;
+    if (tasks[i] && h.stackFree[i] < healthMinStackBytes && lowStack < 0) lowStack = i;
+  }
+
+  uint8_t cause = RESTART_NONE;
+  if (lowStack >= 0) cause = RESTART_STACK_LOW;
+  else if (h.freeHeap < healthMinFreeHeap) cause = RESTART_HEAP_LOW;
+  else if (h.largestBlock < healthMinLargestBlock) cause = RESTART_HEAP_FRAGMENTED;
+
+  if (cause == RESTART_NONE) { h.badChecks = 0; return; }
+  if (++h.badChecks < healthTripChecks || h.restartRequested) return;
+
+  RestartRecord& r = h.pending;
+  memset(&r, 0, sizeof(r));
+  r.cause = cause;
+  if (lowStack >= 0) {
+    strncpy(r.task, healthTaskNames[lowStack], sizeof(r.task) - 1);
+    r.stackFree = h.stackFree[lowStack];
+  }
+  r.freeHeap = h.freeHeap;
+  r.largestBlock = h.largestBlock;
+  r.minFreeHeap = h.minFreeHeap;
+  r.uptimeSec = millis() / 1000;
+  h.restartRequestedAt = millis();
+  h.restartRequested = true;
+
+  char text[160];
+  snprintf(text, sizeof(text), "🩺 [健康監控] %s (heap %u / 最大區塊 %u)，待設備停止後重新啟動",
+           restartCauseName(cause), (unsigned)h.freeHeap, (unsigned)h.largestBlock);
+  raiseAlert(text);
+}
+
+void publishHealth() {
+  const HealthState& h = health;
+  char buf[448];
+  int len = snprintf(buf, sizeof(buf),
+           "{\"heap_free\":%u,\"heap_largest\":%u,\"heap_min\":%u,\"frag_pct\":%u"
+           ",\"stack_control\":%u,\"stack_sensor\":%u,\"stack_net\":%u,\"stack_alert\":%u"
+           ",\"bad_checks\":%u,\"restart_pending\":%d,\"uptime_s\":%u,\"reset_reason\":\"%s\""
+           ",\"last_restart\":\"%s\",\"last_restart_task\":\"%s\",\"last_restart_heap\":%u,\"last_restart_largest\":%u}",
+           (unsigned)h.freeHeap, (unsigned)h.largestBlock, (unsigned)h.minFreeHeap,
+           (unsigned)(h.freeHeap ? 100 - (uint64_t)h.largestBlock * 100 / h.freeHeap : 0),
+           (unsigned)h.stackFree[0], (unsigned)h.stackFree[1], (unsigned)h.stackFree[2], (unsigned)h.stackFree[3],
+           (unsigned)h.badChecks, h.restartRequested ? 1 : 0, (unsigned)(millis() / 1000), resetReasonName(h.resetReason),
+           restartCauseName(h.last.cause), h.last.task, (unsigned)h.last.freeHeap, (unsigned)h.last.largestBlock);
+  publishRaw(topic_health, (const uint8_t*)buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+// 控制任務呼叫：設備都停止 (或等太久) 才重開機
+void healthMaybeRestart(unsigned long currentMillis) {
+  if (!health.restartRequested) return;
+  bool idle = farm.idle();
+  if (!idle && currentMillis - health.restartRequestedAt < healthRestartGraceMs) return;
+  digitalWrite(pumpPin, LOW); digitalWrite(fertPin, LOW);
+  if (xSemaphoreTake(persistLock, pdMS_TO_TICKS(1000)) == pdTRUE) { // 網路任務可能正在寫 NVS
+    prefs.putBytes("restart", &health.pending, sizeof(RestartRecord));
+    xSemaphoreGive(persistLock);
+  }
+  persistFlush(true); prefs.end(); delay(1000); ESP.restart();
+}
+
+// ==========================================
+//  [新增] 積熱電驛跳脫中斷
+//  過載輸入的下降緣直接在 ISR 裡寫 GPIO.out_w1tc 關掉對應的輸出，
+//  不等控制週期、也不受網路任務 (TLS 握手、RS485 等待) 影響；
+//  之後叫醒控制任務，由 farm.tick() 當作過載處理 (狀態、警報)。
+//  跳脫會鎖存到控制任務取走為止，期間控制任務不會把輸出重新打開，
+//  即使電驛接點彈跳、控制任務讀腳位時已經恢復也一樣。
+//  中斷在 setup() 掛上 (核心 1，與控制任務同核心，不和 WiFi 搶)。
+//  [修改] 掛在 IRAM 的 GPIO 中斷服務上，ISR 只用 IRAM 函式與 DRAM 變數，
+//  NVS / 流水記錄寫 flash 的期間跳脫照樣立即切斷輸出。
+// ==========================================
+static_assert(pumpPin < 32 && fertPin < 32, "out_w1tc 只涵蓋 GPIO0~31");
+
+struct OverloadChannel {
+  volatile bool latched;    // ISR 已關掉輸出，控制任務尚未處理
+  uint32_t trips;           // 鎖存次數 (彈跳不重複計)
+  uint32_t edges;           // 中斷次數
+  int64_t tripUs;           // 最近一次跳脫的時間
+  uint32_t clearCycles;     // 進入 ISR 到輸出關閉 (不含下降緣到 ISR 的派發延遲)
+  uint32_t maxClearCycles;
+  uint32_t handledUs;       // 跳脫到控制任務處理完
+  uint32_t maxHandledUs;
+};
+
+OverloadChannel overload[2] = {};   // 0 = 水泵, 1 = 施肥機
+portMUX_TYPE overloadMux = portMUX_INITIALIZER_UNLOCKED;
+
+void IRAM_ATTR overloadIsr(void* arg) {
+  uint32_t t0 = esp_cpu_get_cycle_count();
+  uint32_t ch = (uint32_t)(uintptr_t)arg;
+  GPIO.out_w1tc = 1UL << (ch ? fertPin : pumpPin);
+  uint32_t cycles = esp_cpu_get_cycle_count() - t0;
+
+  OverloadChannel& o = overload[ch];
+  portENTER_CRITICAL_ISR(&overloadMux);
+  o.edges++;
+  if (!o.latched) {
+    o.latched = true;
+    o.trips++;
+    o.tripUs = esp_timer_get_time();
+    o.clearCycles = cycles;
+    if (cycles > o.maxClearCycles) o.maxClearCycles = cycles;
+  }
+  portEXIT_CRITICAL_ISR(&overloadMux);
+
+  BaseType_t woken = pdFALSE;
+  if (controlTaskHandle != NULL) vTaskNotifyGiveFromISR(controlTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+void overloadBegin() {
+  if (!gpioIsrBegin()) { Serial.println("GPIO 中斷服務安裝失敗"); return; }
+  gpio_set_intr_type((gpio_num_t)olPumpPin, GPIO_INTR_NEGEDGE);
+  gpio_set_intr_type((gpio_num_t)olFertPin, GPIO_INTR_NEGEDGE);
+  gpio_isr_handler_add((gpio_num_t)olPumpPin, overloadIsr, (void*)0);
+  gpio_isr_handler_add((gpio_num_t)olFertPin, overloadIsr, (void*)1);
+}
+
+// 控制任務讀輸入時呼叫：取出鎖存的跳脫 (視同這一週期讀到過載)
+bool overloadTake(uint8_t ch) {
+  OverloadChannel& o = overload[ch];
+  portENTER_CRITICAL(&overloadMux);
+  bool tripped = o.latched;
+  o.latched = false;
+  int64_t tripUs = o.tripUs;
+  portEXIT_CRITICAL(&overloadMux);
+  if (!tripped) return false;
+  o.handledUs = (uint32_t)(esp_timer_get_time() - tripUs);
+  if (o.handledUs > o.maxHandledUs) o.maxHandledUs = o.handledUs;
+  return true;
+}
+
+// 寫輸出與 ISR 互斥：讀輸入之後才發生的跳脫，這一週期也不會被蓋回 HIGH
+void overloadGuardedWrite(bool pumpOn, bool fertOn) {
+  portENTER_CRITICAL(&overloadMux);
+  digitalWrite(pumpPin, pumpOn && !overload[0].latched ? HIGH : LOW);
+  digitalWrite(fertPin, fertOn && !overload[1].latched ? HIGH : LOW);
+  portEXIT_CRITICAL(&overloadMux);
+}
+
+// ==========================================
+//  [新增] 控制邏輯 (每個控制週期執行一次，不可阻塞)
+//  [修改] 只負責收集輸入、呼叫 farm.tick()、套用輸出與送出警報
+// ==========================================
+const char* const controlEventText[EV_COUNT] = {
+  "👋 [手動介入] 切換為手動模式",
+  "🔴 [警報] 系統緊急停機！",
+  "🟢 切換為自動模式",
+  "🟠 切換為手動模式",
+  nullptr,                  // EV_SOIL_SET：含設定值，另外組字串
+  "⚠️ [故障] RS485 土壤感測器讀取失敗！",
+  "🚨 [警報] 水泵積熱電驛跳脫！",
+  "🚨 [警報] 施肥機積熱電驛跳脫！",
+  "⚠️ [回授異常] 水泵啟動失敗！",
+  "🚨 [危險警報] 水泵異常運轉！",
+  "⚠️ [回授異常] 施肥機啟動失敗！",
+  "🚨 [危險警報] 施肥機異常運轉！",
+  "💧 [自動] 開始施肥",
+  "✅ [自動] 施肥完成",
+  "⚠️ [超時] 水泵運轉過久鎖定",
+  "✅ 定時澆水完成",
+};
+
+void controlCycle(unsigned long currentMillis) {
+    FarmCmd cmd;
+    {
+      StageScope st(STAGE_CTL_CMDS);
+      while (xQueueReceive(cmdQueue, &cmd, 0) == pdTRUE) {
+          applyCommand(cmd, currentMillis);
+      }
+    }
+
+    ControlInput in = {};
+    in.nowMs = currentMillis;
+    {
+      StageScope st(STAGE_CTL_LOCALTIME);
+      struct tm timeinfo;
+      in.timeSynced = farmLocalTime(&timeinfo); // 不等待 NTP，未同步就直接跳過
+      in.hour = timeinfo.tm_hour;
+      in.minute = timeinfo.tm_min;
+      in.yday = timeinfo.tm_yday;
+    }
+
+    // [修改] 移除每天 03:00 的無條件重開機，只在健康監控判定需要時才重開
+    healthMaybeRestart(currentMillis);
+
+    // --- 讀取環境數據 (感測任務提供的最新快照) ---
+    SensorSnapshot snap;
+    bool haveSnap = xQueuePeek(sensorMailbox, &snap, 0) == pdTRUE;
+    float airHum = haveSnap && snap.dhtOk ? snap.airHum : 0;   // DHT 故障時回報 0 (與原版相同)
+    float airTemp = haveSnap && snap.dhtOk ? snap.airTemp : 0;
+    if (haveSnap) {
+        soil_hum = snap.soilHum;
+        soil_temp = snap.soilTemp;
+        soil_ec = snap.ec;
+        soil_salinity = snap.salinity;
+    }
+    // [新增] 感測任務停止更新時快照會一直停在最後一筆：過舊就當作沒有快照，走 sensorError 停水泵
+    static bool snapStale = false;
+    bool stale = haveSnap && (long)(currentMillis - snap.takenMs) > (long)sensorStaleMs;
+    if (stale && !snapStale) raiseAlert("⚠️ [故障] 感測資料停止更新！");
+    snapStale = stale;
+    in.haveSensor = haveSnap && !stale;
+    in.rs485Ok = in.haveSensor && snap.rs485Ok;
+    in.soilHum = soil_hum;
+
+    // --- 積熱電驛與接觸器回授 (LOW = 跳脫 / 吸合) ---
+    in.pumpOverload = (digitalRead(olPumpPin) == LOW) | overloadTake(0); // [修改] 含中斷鎖存的跳脫
+    in.fertOverload = (digitalRead(olFertPin) == LOW) | overloadTake(1);
+    in.pumpFeedback = (digitalRead(fbPumpPin) == LOW);
+    in.fertFeedback = (digitalRead(fbFertPin) == LOW);
+
+    ControlOutput out;
+    {
+      StageScope st(STAGE_CTL_TICK);
+      out = farm.tick(in);
+    }
+    overloadGuardedWrite(out.pump, out.fert);
+
+    if (out.events & (1UL << EV_STOP)) allValvesOff();
+    for (uint8_t e = 0; e < EV_COUNT; e++) {
+        if (!(out.events & (1UL << e))) continue;
+        if (e == EV_SOIL_SET) {
+            char text[64];
+            snprintf(text, sizeof(text), "⚙️ 土壤濕度設定：%d%% ~ %d%%", farm.config().soilLow, farm.config().soilHigh);
+            raiseAlert(text);
+        } else {
+            raiseAlert(controlEventText[e]);
+        }
+    }
+    int status = out.status;
+
+    persistUpdate(currentMillis);
+
+    FarmTelemetry t = { airTemp, airHum, soil_hum, soil_temp, soil_ec, soil_salinity, status };
+    xQueueOverwrite(telemetryMailbox, &t);
+
+    // [新增] 狀態改變 (例如過載跳脫) 立刻叫醒網路任務，不必等下一輪
+    static int lastStatus = -1;
+    if (status != lastStatus) {
+        lastStatus = status;
+        if (netTaskHandle != NULL) xTaskNotifyGive(netTaskHandle);
+    }
+}
+
+// ==========================================
+//  [新增] 農場物理模擬器 (MQTT 指令 SIM)
+//  虛擬時鐘每步 1 秒，驅動一個獨立的 FarmController (simFarm)：
+//  - 土壤：白天蒸散 (依時段正弦分布，一天共 simEtPerDay %)，水泵吸合時每分鐘 +wet %，
+//    施肥機吸合時每分鐘 +simFertWetPerMin %，超過田間容水量的部分慢慢排掉
+//  - 接觸器：線圈通電且積熱電驛未跳脫才吸合
+//  - 積熱電驛：吸合時累積熱量、停止時以一半速度散熱，滿 trip_min 分鐘跳脫，散到一半自動復歸
+//  - 值班人員：每天 07:00 若水泵超時鎖定就送 AUTO_ON 解除
+//  [修改] 在核心 1 的最低優先權任務執行，只用 simFarm 與 simPlant：
+//  不碰實際的 farm、控制任務、指令佇列、腳位、NVS 與警報，控制週期與中斷照常。
+//  每跑 simSliceUs 讓出一個 tick，同核心的 idle 任務 (看門狗) 才有機會執行。
+// ==========================================
+const uint32_t simStepMs = 1000;
+const uint32_t simSliceUs = 7000;
+const float simEtPerDay = 12.0f;
+const float simFertWetPerMin = 0.2f;
+const float simFieldCapacity = 85.0f;
+const uint32_t simOperatorSec = 7 * 3600;
+
+struct SimPlant {
+  float soil;
+  float etPerStep[24];      // 各小時每一步的蒸散量
+  uint32_t sec;             // 虛擬時間，從第 0 天 00:00 起算
+  uint32_t baseMs;          // 虛擬時間 0 對應的控制器時間
+  uint32_t pumpHeatMs;
+  uint32_t fertHeatMs;
+  bool pumpTripped;
+  bool fertTripped;
+  bool pumpCoil;            // 控制器上一步的輸出 (線圈)
+  bool fertCoil;
+  bool softAlarm;
+  uint32_t pumpOnMs;        // 當天累計吸合
+  uint32_t fertOnMs;
+  uint32_t alerts;          // 當天 simFarm 產生的事件
+  int64_t dayStartUs;
+};
+
+SimPlant simPlant;
+FarmController simFarm(controlDefaults);
+
+void simBegin() {
+  SimPlant& p = simPlant;
+  memset(&p, 0, sizeof(p));
+  p.soil = 50.0f;
+  float total = 0;
+  for (int h = 6; h < 18; h++) total += sinf(PI * (h - 6 + 0.5f) / 12);
+  for (int h = 0; h < 24; h++) {
+    float w = (h >= 6 && h < 18) ? sinf(PI * (h - 6 + 0.5f) / 12) / total : 0;
+    p.etPerStep[h] = simEtPerDay * w * simStepMs / 3600000.0f;
+  }
+  p.baseMs = millis();
+
+  simFarm = FarmController(sim.cfg); // 沿用收到指令時的上下限，自動模式、無鎖定
+  simFarm.restore(true, false, -1, 0, 0, p.baseMs);
+
+  memset(sim.day, 0, sizeof(sim.day));
+  sim.day[0].soilMin = 100;
+  p.dayStartUs = esp_timer_get_time();
+  portENTER_CRITICAL(&simMux);
+  sim.daysDone = 0;
+  sim.daysPublished = 0;
+  sim.pending = false;
+  sim.active = true;
+  portEXIT_CRITICAL(&simMux);
+}
+
+void simEnd() {
+  portENTER_CRITICAL(&simMux);
+  sim.active = false;
+  sim.finished = true;
+  portEXIT_CRITICAL(&simMux);
+  if (netTaskHandle != NULL) xTaskNotifyGive(netTaskHandle);
+}
+
+// 積熱電驛；回傳 true = 這一步剛跳脫
+bool simThermal(uint32_t& heatMs, bool& tripped, bool on) {
+  if (!sim.tripMin) return false;
+  uint32_t limit = sim.tripMin * 60000UL;
+  if (on) heatMs += simStepMs;
+  else heatMs = heatMs > simStepMs / 2 ? heatMs - simStepMs / 2 : 0;
+  if (!tripped && heatMs >= limit) { tripped = true; return true; }
+  if (tripped && heatMs <= limit / 2) tripped = false;
+  return false;
+}
+
+void simStep() {
+  SimPlant& p = simPlant;
+  SimDay& d = sim.day[sim.daysDone];
+
+  // 依控制器上一步的輸出更新接觸器與積熱電驛
+  if (simThermal(p.pumpHeatMs, p.pumpTripped, p.pumpCoil && !p.pumpTripped)) d.trips++;
+  if (simThermal(p.fertHeatMs, p.fertTripped, p.fertCoil && !p.fertTripped)) d.trips++;
+  bool pumpOn = p.pumpCoil && !p.pumpTripped;
+  bool fertOn = p.fertCoil && !p.fertTripped;
+  if (pumpOn) p.pumpOnMs += simStepMs;
+  if (fertOn) p.fertOnMs += simStepMs;
+
+  p.soil -= p.etPerStep[p.sec / 3600 % 24];
+  if (pumpOn) p.soil += sim.wetPerMin * simStepMs / 60000.0f;
+  if (fertOn) p.soil += simFertWetPerMin * simStepMs / 60000.0f;
+  if (p.soil > simFieldCapacity) p.soil -= (p.soil - simFieldCapacity) * 0.001f;
+  if (p.soil < 1.0f) p.soil = 1.0f;
+  if (p.soil > 100.0f) p.soil = 100.0f;
+  if (p.soil < d.soilMin) d.soilMin = p.soil;
+  if (p.soil > d.soilMax) d.soilMax = p.soil;
+
+  p.sec++;
+  uint32_t nowMs = p.baseMs + p.sec * simStepMs;
+  if (p.sec % 86400 == simOperatorSec && simFarm.pumpSoftAlarm()) {
+    FarmCmd cmd = { CMD_AUTO_ON, 0, 0 };
+    simFarm.command(cmd, nowMs);
+  }
+
+  ControlInput in = {};
+  in.nowMs = nowMs;
+  in.timeSynced = true;
+  in.hour = p.sec / 3600 % 24;
+  in.minute = p.sec / 60 % 60;
+  in.yday = p.sec / 86400 % 365;
+  in.haveSensor = true;
+  in.rs485Ok = true;
+  in.soilHum = roundf(p.soil * 10) / 10; // 探頭解析度 0.1 %
+  in.pumpOverload = p.pumpTripped;
+  in.fertOverload = p.fertTripped;
+  in.pumpFeedback = pumpOn;
+  in.fertFeedback = fertOn;
+  ControlOutput out = simFarm.tick(in);
+
+  if (out.pump && !p.pumpCoil) d.pumpCycles++;
+  if (out.fert && !p.fertCoil) d.fertCycles++;
+  p.pumpCoil = out.pump;
+  p.fertCoil = out.fert;
+  p.alerts += __builtin_popcount(out.events); // 每個事件在實機上就是一則警報
+  if (simFarm.pumpSoftAlarm() && !p.softAlarm) d.lockouts++;
+  p.softAlarm = simFarm.pumpSoftAlarm();
+
+  if (p.sec % 86400 != 0) return;
+
+  // 一天結束
+  int64_t nowUs = esp_timer_get_time();
+  d.pumpOnMin = p.pumpOnMs / 60000;
+  d.fertOnMin = p.fertOnMs / 60000;
+  d.alerts = p.alerts;
+  d.wallUs = nowUs - p.dayStartUs;
+  p.alerts = 0;
+  p.pumpOnMs = p.fertOnMs = 0;
+  p.dayStartUs = nowUs;
+  uint16_t next = sim.daysDone + 1;
+  if (next < sim.days) sim.day[next].soilMin = 100;
+  portENTER_CRITICAL(&simMux);
+  sim.daysDone = next;
+  portEXIT_CRITICAL(&simMux);
+  if (next >= sim.days) simEnd();
+}
+
+// 模擬任務 (核心 1，最低優先權)：平常睡著，收到 SIM 指令才跑
+void simTask(void* arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!sim.pending) continue;
+    simBegin();
+    while (sim.active) {
+      int64_t start = esp_timer_get_time();
+      while (sim.active && esp_timer_get_time() - start < simSliceUs) simStep();
+      vTaskDelay(1);
+    }
+  }
+}
+
+// 網路任務呼叫：跑完的天數逐日發佈，全部結束後再送一筆總結
+void simPublish() {
+  portENTER_CRITICAL(&simMux);
+  uint16_t done = sim.daysDone;
+  uint16_t pub = sim.daysPublished;
+  bool finished = sim.finished;
+  portEXIT_CRITICAL(&simMux);
+
+  char buf[256];
+  for (; pub < done; pub++) {
+    const SimDay& d = sim.day[pub];
+    snprintf(buf, sizeof(buf),
+             "{\"day\":%u,\"pump_cycles\":%u,\"fert_cycles\":%u,\"pump_min\":%u,\"fert_min\":%u"
+             ",\"lockouts\":%u,\"trips\":%u,\"alerts\":%u,\"soil_min\":%u,\"soil_max\":%u,\"wall_ms\":%u}",
+             (unsigned)pub + 1, (unsigned)d.pumpCycles, (unsigned)d.fertCycles, (unsigned)d.pumpOnMin,
+             (unsigned)d.fertOnMin, (unsigned)d.lockouts, (unsigned)d.trips, (unsigned)d.alerts,
+             (unsigned)d.soilMin, (unsigned)d.soilMax, (unsigned)(d.wallUs / 1000));
+    if (!client.publish(topic_sim, buf)) break; // 下次從這一天接著送
+  }
+  portENTER_CRITICAL(&simMux);
+  sim.daysPublished = pub;
+  portEXIT_CRITICAL(&simMux);
+  if (!finished || pub < done) return;
+
+  uint32_t pumpCycles = 0, fertCycles = 0, lockouts = 0, trips = 0, alerts = 0;
+  uint64_t wallUs = 0;
+  for (uint16_t i = 0; i < done; i++) {
+    const SimDay& d = sim.day[i];
+    pumpCycles += d.pumpCycles; fertCycles += d.fertCycles;
+    lockouts += d.lockouts; trips += d.trips; alerts += d.alerts;
+    wallUs += d.wallUs;
+  }
+  snprintf(buf, sizeof(buf),
+           "{\"sim\":\"done\",\"days\":%u,\"wet\":%u,\"trip_min\":%u,\"pump_cycles\":%u,\"fert_cycles\":%u"
+           ",\"lockouts\":%u,\"trips\":%u,\"alerts\":%u,\"wall_ms\":%u,\"speedup\":%u}",
+           (unsigned)done, (unsigned)sim.wetPerMin, (unsigned)sim.tripMin, (unsigned)pumpCycles, (unsigned)fertCycles,
+           (unsigned)lockouts, (unsigned)trips, (unsigned)alerts, (unsigned)(wallUs / 1000),
+           (unsigned)(wallUs ? (uint64_t)done * 86400000000ULL / wallUs : 0));
+  if (!client.publish(topic_sim, buf)) return;
+  portENTER_CRITICAL(&simMux);
+  sim.finished = false;
+  portEXIT_CRITICAL(&simMux);
+}
+
+// ==========================================
+//  [新增] 控制任務 (核心 1，最高優先權，固定週期)
+// ==========================================
+void controlTask(void* arg) {
+  TickType_t lastWake = xTaskGetTickCount();
+  int64_t lastStart = esp_timer_get_time();
+  for (;;) {
+    // [修改] 等到下一個週期；積熱電驛中斷會提早叫醒，立即處理跳脫 (不算一個週期，不列入統計)
+    TickType_t wait = lastWake + pdMS_TO_TICKS(controlPeriodMs) - xTaskGetTickCount();
+    if (wait <= pdMS_TO_TICKS(controlPeriodMs) && ulTaskNotifyTake(pdTRUE, wait) > 0) {
+      controlCycle(millis());
+      continue;
+    }
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(controlPeriodMs));
+
+    int64_t start = esp_timer_get_time();
+    {
+      StageScope st(STAGE_CTL_CYCLE);
+      controlCycle(millis());
+    }
+    uint32_t execUs = (uint32_t)(esp_timer_get_time() - start);
+    uint32_t periodUs = (uint32_t)(start - lastStart);
+    lastStart = start;
+
+    portENTER_CRITICAL(&ctlStatsMux);
+    ctlStats.cycles++;
+    ctlStats.sumExecUs += execUs;
+    if (execUs > ctlStats.maxExecUs) ctlStats.maxExecUs = execUs;
+    if (periodUs > ctlStats.maxPeriodUs) ctlStats.maxPeriodUs = periodUs;
+    if (execUs > controlBudgetUs || periodUs > controlPeriodMs * 1000 + controlBudgetUs) ctlStats.overruns++;
+    portEXIT_CRITICAL(&ctlStatsMux);
+  }
+}
+
+// ==========================================
+//  [新增] 感測任務 (核心 0)：DHT + RS485，結果放進信箱
+// ==========================================
+void sensorTask(void* arg) {
+  SensorSnapshot snap = {}; // 讀取失敗時保留上一次的土壤數值
+  unsigned long lastDht = 0;
+  uint8_t dhtFails = 0;
+  bool first = true;
+  bool soilReady = false;   // 第一筆 RS485 結果出來前不發佈，避免開機誤報
+  int activeProbe = -1;
+  uint8_t activeBlock = 0;
+  int activeRelay = -1;
+  bool lastSlotRelay = false; // 繼電器與探頭輪流使用匯流排，探頭不會被餓死
+  uint32_t sweepMask = 0;   // 本輪已輪詢過的探頭
+  unsigned long sweepStart = millis();
+  for (;;) {
+    unsigned long now = millis();
+    bool changed = false;
+
+    // [修改] DHT：只送起始訊號，之後由 ISR 擷取、下一輪再解碼，不再關中斷忙等
+    uint32_t c0 = ESP.getCycleCount();
+    if (first || now - lastDht >= sensorPeriodMs) {
+      lastDht = now;
+      dhtReader.start();
+    }
+    dhtReader.poll();
+    if (dhtReader.done()) {
+      float h, t;
+      if (dhtReader.finish(h, t) == DHT_OK) {
+        snap.airHum = h;
+        snap.airTemp = t;
+        snap.dhtOk = true;
+        dhtFails = 0;
+      } else if (++dhtFails >= dhtFailLimit) {
+        snap.dhtOk = false; // 偶發的校驗錯誤沿用上一筆
+      }
+      changed = true;
+    }
+    stageRecord(STAGE_SNS_DHT, ESP.getCycleCount() - c0);
+
+    // RS485：送出後立即返回，由 poll() 在背景完成交易
+    c0 = ESP.getCycleCount();
+    if (rs485Bus.ready()) {
+      if (activeProbe < 0 && activeRelay < 0) {
+        int probe = pickNextProbe(now);
+        int relay = pickRelayJob(now);
+        if (relay >= 0 && (probe < 0 || !lastSlotRelay)) {
+          activeRelay = relay;
+          lastSlotRelay = true;
+          relayBegin(relay);
+        } else if (probe >= 0) {
+          activeProbe = probe;
+          activeBlock = 0;
+          lastSlotRelay = false;
+        }
+      }
+      if (activeProbe >= 0) {
+        const SoilReadBlock& b = soilProbes[activeProbe].blocks[activeBlock];
+        rs485Bus.begin(b.query, sizeof(b.query));
+      }
+    }
+    rs485Bus.poll();
+    bool probeDone = false;
+    if (activeRelay >= 0 && rs485Bus.done()) {
+      relayDone(activeRelay, rs485Bus.finish(), now);
+      activeRelay = -1;
+    } else if (activeProbe >= 0 && rs485Bus.done()) {
+      if (soilBlockDone(activeProbe, activeBlock, rs485Bus.finish(), now)) activeBlock++; // 同一探頭的下一個區塊
+      else probeDone = true;
+    }
+    if (probeDone) {
+      sweepMask |= (1UL << activeProbe);
+      activeProbe = -1;
+
+      snap.rs485Ok = aggregateSoil(snap);
+      soilReady = true;
+      changed = true;
+
+      // 一輪 = 所有未離線的探頭都輪詢過一次
+      uint32_t required = 0;
+      for (int i = 0; i < soilProbeCount; i++) {
+        if (soilProbes[i].failStreak < soilOfflineAfter) required |= (1UL << i);
+      }
+      if ((sweepMask & required) == required) {
+        uint32_t sweepMs = now - sweepStart;
+        portENTER_CRITICAL(&probesMux);
+        soilBusStats.sweeps++;
+        soilBusStats.lastSweepMs = sweepMs;
+        if (sweepMs > soilBusStats.maxSweepMs) soilBusStats.maxSweepMs = sweepMs;
+        if (sweepMs > soilSweepBudgetMs) soilBusStats.overBudget++;
+        portEXIT_CRITICAL(&probesMux);
+        sweepMask = 0;
+        sweepStart = now;
+      }
+    }
+    stageRecord(STAGE_SNS_BUS, ESP.getCycleCount() - c0);
+
+    first = false;
+    if (changed && soilReady) {
+      snap.takenMs = millis();
+      xQueueOverwrite(sensorMailbox, &snap);
+    }
+    ulTaskNotifyTake(pdTRUE, 1); // 最多等 1 tick，訊框收齊時由 UART 回調提早喚醒
+  }
+}
+
+// ==========================================
+//  [新增] ThingSpeak 批次上傳
+//  每 uploadInterval 存一筆到環形暫存，每 thingspeakBatchMs 用 bulk_update
+//  一次 POST 出去；HTTP/1.1 keep-alive 沿用同一條連線。
+//  只有伺服器回 2xx 才把送出的筆數從暫存移除，失敗就整批留著下次重送，
+//  期間新進的樣本接在後面，不會重複。
+// ==========================================
+struct TsSample {
+  uint32_t epoch;
+  FarmTelemetry t;
+};
+
+struct ThingSpeakStats {
+  uint32_t requests;
+  uint32_t samples;         // 成功上傳的筆數
+  uint32_t failures;
+  uint32_t connects;        // 新建 TCP 連線次數 (其餘為沿用)
+  uint32_t dropped;         // 暫存滿而丟棄
+  uint32_t lastMs;          // 最近一次請求佔用網路任務的時間
+  uint32_t maxMs;
+};
+
+TsSample tsBuffer[TS_BUFFER_SLOTS];
+uint16_t tsHead = 0;        // 最舊的一筆
+uint16_t tsCount = 0;
+ThingSpeakStats tsStats = {};
+WiFiClient tsClient;
+unsigned long tsNextSend = 0;
+
+void thingspeakAdd(const FarmTelemetry& t, uint32_t epoch) {
+  if (tsCount == TS_BUFFER_SLOTS) {
+    tsHead = (tsHead + 1) % TS_BUFFER_SLOTS;
+    tsCount--;
+    tsStats.dropped++;
+  }
+  tsBuffer[(tsHead + tsCount) % TS_BUFFER_SLOTS] = { epoch, t };
+  tsCount++;
+}
+
+// 一筆 update 的 JSON (欄位對應與舊版 GET 相同)
+static int thingspeakFormat(const TsSample& s, bool first, char* buf, size_t size) {
+  time_t e = s.epoch;
+  struct tm utc;
+  gmtime_r(&e, &utc);
+  return snprintf(buf, size,
+                  "%s{\"created_at\":\"%04d-%02d-%02d %02d:%02d:%02d +0000\",\"field1\":%.2f,\"field2\":%.2f"
+                  ",\"field3\":%.2f,\"field4\":%d,\"field5\":%d,\"field6\":%.2f}",
+                  first ? "" : ",", utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+                  s.t.airTemp, s.t.airHum, s.t.soilHum, s.t.status, s.t.ec, s.t.soilTemp);
+}
+
+// 送出目前暫存的所有樣本，成功回傳 true
+bool thingspeakSend() {
+  uint16_t n = tsCount;
+  if (n == 0) return true;
+  unsigned long t0 = millis();
+
+  // 先算內容長度，再邊格式化邊寫出，不需要大緩衝
+  char head[96], item[192], tail[8] = "]}";
+  int headLen = snprintf(head, sizeof(head), "{\"write_api_key\":\"%s\",\"updates\":[", writeApiKey.c_str());
+  size_t bodyLen = headLen + strlen(tail);
+  for (uint16_t i = 0; i < n; i++) bodyLen += thingspeakFormat(tsBuffer[(tsHead + i) % TS_BUFFER_SLOTS], i == 0, item, sizeof(item));
+
+  if (!tsClient.connected()) {
+    tsClient.stop();
+    if (!tsClient.connect(thingspeakHost, thingspeakPort)) return false;
+    tsStats.connects++;
+  }
+
+  char req[224];
+  int reqLen = snprintf(req, sizeof(req),
+                        "POST /channels/%s/bulk_update.json HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                        "Content-Length: %u\r\nConnection: keep-alive\r\n\r\n",
+                        thingspeakChannel, thingspeakHost, (unsigned)bodyLen);
+  bool ok = tsClient.write((const uint8_t*)req, reqLen) == (size_t)reqLen &&
+            tsClient.write((const uint8_t*)head, headLen) == (size_t)headLen;
+  for (uint16_t i = 0; ok && i < n; i++) {
+    int len = thingspeakFormat(tsBuffer[(tsHead + i) % TS_BUFFER_SLOTS], i == 0, item, sizeof(item));
+    ok = tsClient.write((const uint8_t*)item, len) == (size_t)len;
+  }
+  if (ok) ok = tsClient.write((const uint8_t*)tail, strlen(tail)) == strlen(tail);
+
+  bool keepAlive = false;
+  int code = ok ? readHttpResponse(tsClient, millis() + discordIoTimeout, keepAlive) : -1;
+  if (!keepAlive) tsClient.stop();
+
+  tsStats.requests++;
+  tsStats.lastMs = millis() - t0;
+  if (tsStats.lastMs > tsStats.maxMs) tsStats.maxMs = tsStats.lastMs;
+  if (code < 200 || code >= 300) { tsStats.failures++; return false; }
+
+  // 只移除這次送出的筆數 (送出期間不會有新樣本，因為同在網路任務)
+  tsHead = (tsHead + n) % TS_BUFFER_SLOTS;
+  tsCount -= n;
+  tsStats.samples += n;
+  return true;
+}
+
+// ==========================================
+//  [新增] 發佈每個探頭的數值與輪詢統計到 farm/probes/<地址>
+// ==========================================
+void publishProbes() {
+  static uint32_t lastPolls[MAX_SOIL_PROBES];
+  static unsigned long lastPublish = 0;
+  unsigned long now = millis();
+  uint32_t elapsed = now - lastPublish;
+  lastPublish = now;
+
+  for (int i = 0; i < soilProbeCount; i++) {
+    SoilProbe p;
+    portENTER_CRITICAL(&probesMux);
+    p = soilProbes[i];
+    portEXIT_CRITICAL(&probesMux);
+
+    // 每分鐘輪詢次數
+    uint32_t rate = elapsed ? (uint32_t)((uint64_t)(p.polls - lastPolls[i]) * 60000 / elapsed) : 0;
+    lastPolls[i] = p.polls;
+
+    char topic[32];
+    char buf[384];
+    snprintf(topic, sizeof(topic), "%s/%u", topic_probes, (unsigned)p.cfg.addr);
+    int n = snprintf(buf, sizeof(buf), "{\"addr\":%u,\"model\":\"%s\",\"online\":%d",
+                     (unsigned)p.cfg.addr, p.cfg.model->name, p.online ? 1 : 0);
+    for (uint8_t f = 0; f < p.cfg.model->regCount && n < (int)sizeof(buf); f++) {
+      const RegisterDesc& d = p.cfg.model->regs[f];
+      n += snprintf(buf + n, sizeof(buf) - n, ",\"%s\":%.2f", d.name, p.values[d.field]);
+    }
+    if (n < (int)sizeof(buf)) {
+      snprintf(buf + n, sizeof(buf) - n,
+               ",\"polls_per_min\":%u,\"ok\":%u,\"timeouts\":%u,\"errors\":%u,\"latency_us\":%u}",
+               (unsigned)rate, (unsigned)p.ok, (unsigned)p.timeouts, (unsigned)p.errors, (unsigned)p.lastLatencyUs);
+    }
+    client.publish(topic, buf);
+  }
+}
+
+// ==========================================
+//  [新增] 發佈繼電器板狀態到 farm/relays/<地址>
+// ==========================================
+void publishRelays() {
+  for (uint8_t i = 0; i < relayBoardCount; i++) {
+    RelayBoard b;
+    portENTER_CRITICAL(&relayMux);
+    b = relayBoards[i];
+    portEXIT_CRITICAL(&relayMux);
+
+    char topic[32];
+    char buf[192];
+    snprintf(topic, sizeof(topic), "%s/%u", topic_relays, (unsigned)b.cfg.addr);
+    snprintf(buf, sizeof(buf),
+             "{\"addr\":%u,\"desired\":%u,\"actual\":%u,\"writes\":%u,\"reads\":%u,\"mismatches\":%u,\"errors\":%u}",
+             (unsigned)b.cfg.addr, (unsigned)b.desired, (unsigned)b.actual, (unsigned)b.writes,
+             (unsigned)b.reads, (unsigned)b.mismatches, (unsigned)b.errors);
+    client.publish(topic, buf);
+  }
+}
+
+// ==========================================
+//  [新增] 發佈控制週期統計到 farm/metrics
+// ==========================================
+void publishMetrics() {
+  ControlStats s;
+  portENTER_CRITICAL(&ctlStatsMux);
+  s = ctlStats;
+  ctlStats = {};
+  portEXIT_CRITICAL(&ctlStatsMux);
+
+  AlertOutbox o;
+  portENTER_CRITICAL(&outboxMux);
+  o.count = outbox.count; o.sent = outbox.sent; o.retries = outbox.retries;
+  o.failed = outbox.failed; o.dropped = outbox.dropped;
+  portEXIT_CRITICAL(&outboxMux);
+
+  ModbusStats mb = rs485Bus.stats;
+  uint32_t mbTotal = mb.ok + mb.timeouts + mb.crcErrors + mb.shortFrames + mb.exceptions + mb.badReplies;
+  SoilBusStats sb;
+  portENTER_CRITICAL(&probesMux);
+  sb = soilBusStats;
+  portEXIT_CRITICAL(&probesMux);
+
+  // [新增] 積熱電驛跳脫：進入 ISR 到輸出關閉 (ns) 與跳脫到控制任務處理完的時間 (us)
+  OverloadChannel ol[2];
+  portENTER_CRITICAL(&overloadMux);
+  ol[0] = overload[0]; ol[1] = overload[1];
+  overload[0].maxClearCycles = overload[1].maxClearCycles = 0;
+  overload[0].maxHandledUs = overload[1].maxHandledUs = 0;
+  portEXIT_CRITICAL(&overloadMux);
+  auto isrNs = [](uint32_t cycles) { return (unsigned)((uint64_t)cycles * 1000 / stageCpuMhz); };
+
+  static char buf[2560]; // 所有欄位都到最大值約 2300 字元；只在網路任務呼叫，放靜態區省堆疊
+  int len = snprintf(buf, sizeof(buf),
+           "{\"ctl_cycles\":%u,\"ctl_avg_us\":%u,\"ctl_max_us\":%u,\"ctl_max_period_us\":%u,\"ctl_overruns\":%u"
+           ",\"alert_pending\":%u,\"alert_sent\":%u,\"alert_retries\":%u,\"alert_failed\":%u,\"alert_dropped\":%u"
+           ",\"tls_handshakes\":%u,\"tls_reused\":%u,\"tls_requests\":%u,\"dns_lookups\":%u,\"tls_last_ms\":%u,\"tls_max_ms\":%u"
+           ",\"mb_ok\":%u,\"mb_timeout\":%u,\"mb_crc_err\":%u,\"mb_short\":%u,\"mb_exception\":%u,\"mb_bad\":%u"
+           ",\"mb_last_us\":%u,\"mb_avg_us\":%u,\"mb_max_us\":%u"
+           ",\"sweeps\":%u,\"sweep_ms\":%u,\"sweep_max_ms\":%u,\"sweep_over_budget\":%u"
+           ",\"dht_ok\":%u,\"dht_no_reply\":%u,\"dht_checksum\":%u"
+           ",\"tele_sent\":%u,\"tele_suppressed\":%u,\"tele_heartbeats\":%u,\"tele_status_changes\":%u"
+           ",\"nvs_changes\":%u,\"nvs_writes\":%u,\"nvs_last_us\":%u,\"pump_run_min\":%u,\"fert_run_min\":%u"
+           ",\"hist_bytes\":%u,\"hist_psram\":%d,\"hist_raw\":%u,\"hist_min\":%u,\"hist_qtr\":%u"
+           ",\"log_part\":\"%s\",\"log_slots\":%u,\"log_pending\":%u,\"log_written\":%u,\"log_replayed\":%u,\"log_dropped\":%u,\"log_bad\":%u,\"log_write_err\":%u"
+           ",\"ts_requests\":%u,\"ts_samples\":%u,\"ts_failures\":%u,\"ts_connects\":%u,\"ts_buffered\":%u,\"ts_dropped\":%u"
+           ",\"ts_last_ms\":%u,\"ts_max_ms\":%u"
+           ",\"wifi_reconnects\":%u,\"wifi_attempts\":%u,\"wifi_down_ms\":%u,\"wifi_reason\":%u"
+           ",\"mqtt_reconnects\":%u,\"mqtt_attempts\":%u,\"mqtt_down_ms\":%u,\"mqtt_connect_ms\":%u,\"mqtt_connect_max_ms\":%u"
+           ",\"ol_pump_trips\":%u,\"ol_fert_trips\":%u,\"ol_edges\":%u"
+           ",\"ol_isr_clear_ns\":%u,\"ol_isr_clear_max_ns\":%u,\"ol_handled_us\":%u,\"ol_handled_max_us\":%u}",
+           (unsigned)s.cycles, (unsigned)(s.cycles ? s.sumExecUs / s.cycles : 0),
+           (unsigned)s.maxExecUs, (unsigned)s.maxPeriodUs, (unsigned)s.overruns,
+           (unsigned)o.count, (unsigned)o.sent, (unsigned)o.retries, (unsigned)o.failed, (unsigned)o.dropped,
+           (unsigned)discord.handshakes, (unsigned)discord.reused, (unsigned)discord.requests,
+           (unsigned)discord.dnsLookups, (unsigned)discord.lastHandshakeMs, (unsigned)discord.maxHandshakeMs,
+           (unsigned)mb.ok, (unsigned)mb.timeouts, (unsigned)mb.crcErrors, (unsigned)mb.shortFrames,
+           (unsigned)mb.exceptions, (unsigned)mb.badReplies, (unsigned)mb.lastLatencyUs, (unsigned)(mbTotal ? mb.sumLatencyUs / mbTotal : 0), (unsigned)mb.maxLatencyUs,
+           (unsigned)sb.sweeps, (unsigned)sb.lastSweepMs, (unsigned)sb.maxSweepMs, (unsigned)sb.overBudget,
+           (unsigned)dhtReader.stats.ok, (unsigned)dhtReader.stats.noReply, (unsigned)dhtReader.stats.checksum,
+           (unsigned)telemetryStats.sent, (unsigned)telemetryStats.suppressed,
+           (unsigned)telemetryStats.heartbeats, (unsigned)telemetryStats.statusChanges,
+           (unsigned)persistStats.changes, (unsigned)persistStats.flashWrites, (unsigned)persistStats.lastWriteUs,
+           (unsigned)farm.pumpRunMin(), (unsigned)farm.fertRunMin(),
+           (unsigned)history.bytes, history.inPsram ? 1 : 0, (unsigned)history.raw.count,
+           (unsigned)history.minute.count, (unsigned)history.quarter.count,
+           flashLog.part ? flashLog.part->label : "none", (unsigned)flashLog.slots, (unsigned)flashLog.pending, (unsigned)flashLog.stats.written,
+           (unsigned)flashLog.stats.replayed, (unsigned)flashLog.stats.dropped, (unsigned)flashLog.stats.badRecords,
+           (unsigned)flashLog.stats.writeErrors,
+           (unsigned)tsStats.requests, (unsigned)tsStats.samples, (unsigned)tsStats.failures, (unsigned)tsStats.connects,
+           (unsigned)tsCount, (unsigned)tsStats.dropped, (unsigned)tsStats.lastMs, (unsigned)tsStats.maxMs,
+           (unsigned)conn.wifiReconnects, (unsigned)conn.wifiAttempts, (unsigned)conn.wifiDownMs, (unsigned)conn.lastReason,
+           (unsigned)conn.mqttReconnects, (unsigned)conn.mqttAttempts, (unsigned)conn.mqttDownMs,
+           (unsigned)conn.lastMqttConnectMs, (unsigned)conn.maxMqttConnectMs,
+           (unsigned)ol[0].trips, (unsigned)ol[1].trips, (unsigned)(ol[0].edges + ol[1].edges),
+           isrNs(ol[0].tripUs >= ol[1].tripUs ? ol[0].clearCycles : ol[1].clearCycles),
+           isrNs(max(ol[0].maxClearCycles, ol[1].maxClearCycles)),
+           (unsigned)(ol[0].tripUs >= ol[1].tripUs ? ol[0].handledUs : ol[1].handledUs),
+           (unsigned)max(ol[0].maxHandledUs, ol[1].maxHandledUs));
+  publishRaw(topic_metrics, (const uint8_t*)buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1); // 直接串流，不受 MQTT 緩衝大小限制
+}
+
+// ==========================================
+//  [新增] 網路任務 (核心 0)：MQTT / Discord / ThingSpeak
+// ==========================================
+void netTask(void* arg) {
+  for (;;) {
+    {
+      StageScope st(STAGE_NET_PERSIST);
+      persistFlush(false); // [新增] 延遲合併寫入 NVS (與連線狀態無關)
+    }
+
+    // [新增] 健康檢查 (與連線狀態無關)
+    static unsigned long lastHealthMs = 0;
+    if (millis() - lastHealthMs >= healthCheckMs) {
+        lastHealthMs = millis();
+        healthCheck();
+        if (client.connected()) publishHealth();
+    }
+
+    // [新增] 每秒存一筆歷史 (斷網期間照樣記錄)
+    static unsigned long lastHistoryMs = millis();
+    if (millis() - lastHistoryMs >= 1000) {
+        lastHistoryMs += 1000;
+        FarmTelemetry ht;
+        if (xQueuePeek(telemetryMailbox, &ht, 0) == pdTRUE) {
+            StageScope st(STAGE_NET_HISTORY);
+            historyAdd(ht, millis() / 1000);
+        }
+        time_t nowEpoch = time(nullptr);
+        if (nowEpoch > 1600000000) history.epochOffset = (int64_t)nowEpoch - millis() / 1000;
+    }
+
+    // [新增] ThingSpeak 樣本先放暫存 (斷網時照樣累積)；需要已對時的時間戳
+    if (millis() - lastUploadTime >= uploadInterval) {
+        lastUploadTime = millis();
+        FarmTelemetry ut;
+        time_t nowEpoch = time(nullptr);
+        if (nowEpoch > 1600000000 && xQueuePeek(telemetryMailbox, &ut, 0) == pdTRUE) {
+            if (tsCount == 0) tsNextSend = millis() + thingspeakBatchMs; // 新的一批從現在開始計時
+            thingspeakAdd(ut, (uint32_t)nowEpoch);
+        }
+    }
+
+    // [新增] 斷線期間寫入 flash 日誌，恢復後分批補送
+    uint32_t c0 = ESP.getCycleCount();
+    if (!client.connected()) {
+        static unsigned long lastLogMs = 0;
+        FarmTelemetry lt;
+        if (millis() - lastLogMs >= flashLogIntervalMs && xQueuePeek(telemetryMailbox, &lt, 0) == pdTRUE) {
+            lastLogMs = millis();
+            time_t nowEpoch = time(nullptr);
+            flashLogAppend(lt, nowEpoch > 1600000000 ? (uint32_t)nowEpoch : 0);
+        }
+        if (flashLog.staged && millis() - flashLog.firstStagedMs >= flashLogFlushMs) flashLogFlush();
+    } else {
+        flashLogReplay();
+    }
+    stageRecord(STAGE_NET_FLASHLOG, ESP.getCycleCount() - c0);
+
+    // [修改] 不再輪詢 WiFi.status()、不再 disconnect/reconnect/delay，改由連線管理處理
+    {
+      StageScope st(STAGE_NET_CONN);
+      connTick();
+    }
+    if (conn.wifiUp) {
+      {
+        StageScope st(STAGE_NET_MQTT_LOOP);
+        client.loop();
+      }
+
+      unsigned long currentMillis = millis();
+      FarmTelemetry t;
+      bool haveData = (xQueuePeek(telemetryMailbox, &t, 0) == pdTRUE);
+
+      // --- MQTT 發送數據 (包含新要素) ---
+      // [修改] 變化驅動：狀態改變立即送、數值超過死區送、否則只送心跳
+      bool sendNow = false;
+      if (haveData && client.connected()) {
+          long sinceSent = currentMillis - lastTelemetrySentTime;
+          if (!telemetrySentOnce) {
+              sendNow = true;
+          } else if (t.status != lastSentTelemetry.status) {
+              sendNow = true;
+              telemetryStats.statusChanges++;
+          } else if (sinceSent >= telemetryMinGapMs && telemetryExceedsDeadband(t, lastSentTelemetry)) {
+              sendNow = true;
+          } else if (sinceSent >= telemetryHeartbeatMs) {
+              sendNow = true;
+              telemetryStats.heartbeats++;
+          }
+      }
+      if (haveData && currentMillis - lastMqttTime >= mqttInterval) {
+          lastMqttTime = currentMillis;
+          if (!sendNow && currentMillis - lastTelemetrySentTime >= mqttInterval) telemetryStats.suppressed++;
+      }
+      if (sendNow) {
+          StageScope st(STAGE_NET_TELEMETRY);
+          lastSentTelemetry = t;
+          lastTelemetrySentTime = currentMillis;
+          telemetrySentOnce = true;
+          telemetryStats.sent++;
+
+          // [修改] 固定緩衝序列化後直接串流送出，每秒不再配置 String
+          char json[160];
+          size_t len = writeTelemetryJson(t, json, sizeof(json));
+          if (len) publishRaw(topic_data, (const uint8_t*)json, len);
+          if (publishBinary) {
+              uint8_t bin[TELEMETRY_BIN_SIZE];
+              publishRaw(topic_data_bin, bin, packTelemetry(t, bin));
+          }
+      }
+
+      if (client.connected() && (sim.daysPublished != sim.daysDone || sim.finished)) simPublish(); // [新增] 模擬結果
+
+      if (currentMillis - lastMetricsTime >= metricsInterval) {
+          lastMetricsTime = currentMillis;
+          if (client.connected()) {
+              StageScope st(STAGE_NET_METRICS);
+              publishMetrics(); publishProbes(); publishRelays();
+          }
+      }
+
+      // --- ThingSpeak 上傳 (欄位需自行對應) ---
+      // [修改] 累積一批再用 bulk_update 一次送出，失敗則整批保留重送
+      if (tsCount && (long)(currentMillis - tsNextSend) >= 0) {
+        StageScope st(STAGE_NET_THINGSPEAK);
+        tsNextSend = currentMillis + (thingspeakSend() ? thingspeakBatchMs : thingspeakRetryMs);
+      }
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10)); // [修改] 控制任務狀態改變時會提早喚醒
+  }
+}
+
+void setup() {
+  WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0);
+  Serial.begin(115200);
+
+  // [新增] 初始化 RS485 (硬體半雙工：RTS 接 DE/RE，傳送時自動拉高，免去 delay(10) 切換)
+  rs485Serial.begin(9600, SERIAL_8N1, RX_PIN, TX_PIN);
+  rs485Serial.setPins(RX_PIN, TX_PIN, -1, DE_RE_PIN);
+  rs485Serial.setMode(UART_MODE_RS485_HALF_DUPLEX);
+  rs485Serial.setRxTimeout(4);                   // 約 3.5 字元靜默觸發 RX 逾時
+  rs485Serial.onReceive(rs485RxCallback, true);  // 只在逾時 (訊框結束) 時回調
+
+  pinMode(pumpPin, OUTPUT); pinMode(fertPin, OUTPUT);
+  digitalWrite(pumpPin, LOW); digitalWrite(fertPin, LOW); 
+
+  pinMode(olPumpPin, INPUT_PULLUP); pinMode(olFertPin, INPUT_PULLUP);
+  overloadBegin(); // [新增] 跳脫由中斷直接切斷輸出
+  pinMode(fbPumpPin, INPUT_PULLUP); pinMode(fbFertPin, INPUT_PULLUP);
+
+  dhtReader.begin();
+  initSoilProbes();
+  initRelayBoards();
+  if (!historyBegin()) Serial.println("歷史緩衝配置失敗");
+
+  prefs.begin("farm_config", false); 
+  persistLock = xSemaphoreCreateMutex();
+  persistLoad(); // [修改] 一次讀回整個狀態 blob (舊版 is_auto 等 key 自動轉換)
+  healthBegin();
+  // [修改] 補送進度備份在 NVS，要在 prefs.begin() 之後；開機記錄實際使用的分割區
+  if (flashLogBegin()) Serial.printf("斷線日誌使用分割區 \"%s\" (%u KB，%u 筆)\n", flashLog.part->label,
+                                     (unsigned)(flashLog.part->size / 1024), (unsigned)flashLog.slots);
+  else Serial.println(FLASH_LOG_USE_SPIFFS ? "找不到 tlog/spiffs 分割區，斷線資料不會保存"
+                                           : "找不到 tlog 分割區，斷線資料不會保存 (借用 spiffs 需設定 FLASH_LOG_USE_SPIFFS)");
+  esp_register_shutdown_handler(persistShutdownHandler);
+
+  stageCpuMhz = ESP.getCpuFreqMHz(); // [新增] 分段耗時由 cycle 換算成 µs
+  cmdQueue = xQueueCreate(8, sizeof(FarmCmd));
+  sensorMailbox = xQueueCreate(1, sizeof(SensorSnapshot));
+  telemetryMailbox = xQueueCreate(1, sizeof(FarmTelemetry));
+
+  // 控制與感測先啟動：等待 WiFi 期間保護照常運作
+  xTaskCreatePinnedToCore(sensorTask, "sensor", 4096, NULL, 2, &sensorTaskHandle, IO_CORE);
+  xTaskCreatePinnedToCore(controlTask, "control", 4096, NULL, configMAX_PRIORITIES - 2, &controlTaskHandle, CONTROL_CORE);
+  xTaskCreatePinnedToCore(simTask, "sim", 3072, NULL, 1, &simTaskHandle, CONTROL_CORE); // [新增] 加速模擬
+
+  // [修改] 不再卡在 while 等 WiFi；連上與否由事件通知網路任務
+  connBegin();
+
+  configTime(gmtOffset_sec, daylightOffset_sec, ntpServer); // 連上網路後 SNTP 自動對時
+  client.setServer(mqtt_server, mqtt_port);
+  // [修改] metrics / health / history / backlog 都用 beginPublish 串流，不經過這個緩衝；
+  // 仍走 client.publish() 的最大訊息是 farm/probes/<地址> (內容最多 384 bytes + 主題與標頭)
+  client.setBufferSize(512);
+  client.setSocketTimeout(3); // connect() 等 CONNACK 最多 3 秒 (預設 15 秒)
+  client.setCallback(callback); 
+
+  raiseAlert("✅ ESP32 系統已啟動 (RS485版)");
+  if (health.last.cause != RESTART_NONE) {
+    char text[160];
+    snprintf(text, sizeof(text), "🔄 上次由健康監控重新啟動：%s %s (heap %u / 最大區塊 %u，已運行 %u 秒)",
+             restartCauseName(health.last.cause), health.last.task, (unsigned)health.last.freeHeap,
+             (unsigned)health.last.largestBlock, (unsigned)health.last.uptimeSec);
+    raiseAlert(text);
+  } else if (health.resetReason != ESP_RST_POWERON && health.resetReason != ESP_RST_SW) {
+    char text[96];
+    snprintf(text, sizeof(text), "⚠️ 異常重新啟動：%s", resetReasonName(health.resetReason));
+    raiseAlert(text);
+  }
+  xTaskCreatePinnedToCore(netTask, "net", 8192, NULL, 1, &netTaskHandle, IO_CORE);
+  xTaskCreatePinnedToCore(alertTask, "alert", 8192, NULL, 1, &alertTaskHandle, IO_CORE);
+}
+
+void loop() {
+  // 所有工作都在 FreeRTOS 任務中執行，Arduino loopTask 不再需要
+  vTaskDelete(NULL);
 }
@@ -0,0 +1,120 @@
+// ==========================================
+//  主機端效能量測：控制週期 (原 loop())、MQTT 指令 (原 callback())、
+//  土壤探頭交易 (原 readSoilSensor())，以及韌體內建的 BENCH_TICK / BENCH_PARSE。
+//  用法：bench_farm [次數]
+//    perf record -g build/bench_farm 200000
+//    valgrind --tool=callgrind build/bench_farm 2000
+//  時間用主機的實際時間 (ns)；韌體看到的是虛擬時鐘，每個控制週期推進 10 ms。
+// ==========================================
+#include "v11.0.cpp"
+
+#include <chrono>
+#include "host.h"
+
+static uint64_t realNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 模擬的土壤探頭：回應 0x03 讀取，數值由暫存器位址決定 (濕度 0x0000 = 45.5 %)
+static void probePeer(HardwareSerial& port, const uint8_t* req, size_t len) {
+  if (len != 8 || req[1] != 0x03) return;
+  uint16_t start = (req[2] << 8) | req[3];
+  uint16_t count = (req[4] << 8) | req[5];
+  if (count == 0 || count > 125) return;
+  uint8_t reply[MB_MAX_FRAME];
+  reply[0] = req[0];
+  reply[1] = 0x03;
+  reply[2] = 2 * count;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t v = 455 + (start + i) * 17 % 400;
+    reply[3 + 2 * i] = v >> 8;
+    reply[4 + 2 * i] = v & 0xFF;
+  }
+  size_t n = 3 + 2 * count;
+  uint16_t crc = modbusCrc16(reply, n);
+  reply[n] = crc & 0xFF;
+  reply[n + 1] = crc >> 8;
+  port.hostReply(reply, n + 2, 3000);  // 探頭約 3 ms 後開始回應
+}
+
+static void report(const char* name, int iterations, uint64_t ns) {
+  printf("{\"host_bench\":\"%s\",\"samples\":%d,\"ns_per_op\":%.1f}\n", name, iterations, (double)ns / iterations);
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  if (iterations <= 0) iterations = 1;
+
+  setup();
+  rs485Serial.hostSetPeer(probePeer);
+
+  // --- 土壤探頭交易 (送出、背景完成、CRC 驗證、解碼)；順便讓感測信箱有一筆快照 ---
+  int soilRounds = iterations / 100 + 1;
+  uint32_t soilOk = 0;
+  uint64_t busyNs = 0;
+  for (int n = 0; n < soilRounds && soilProbeCount > 0; n++) {
+    SoilProbe& p = soilProbes[0];
+    for (uint8_t b = 0; b < p.blockCount; b++) {
+      uint64_t t0 = realNs();
+      rs485Bus.begin(p.blocks[b].query, sizeof(p.blocks[b].query));
+      busyNs += realNs() - t0;
+      while (!rs485Bus.done()) {
+        hostClockAdvance(500);
+        t0 = realNs();
+        rs485Bus.poll();
+        busyNs += realNs() - t0;
+      }
+      t0 = realNs();
+      bool more = soilBlockDone(0, b, rs485Bus.finish(), millis());
+      busyNs += realNs() - t0;
+      if (!more) break;
+    }
+    soilOk = p.ok;
+  }
+  report("soil_transaction", soilRounds, busyNs);
+  printf("{\"soil_ok\":%u,\"soil_rounds\":%d,\"mb_last_us\":%u}\n", (unsigned)soilOk, soilRounds,
+         (unsigned)rs485Bus.stats.lastLatencyUs);
+  SensorSnapshot snap = {};
+  snap.rs485Ok = aggregateSoil(snap);
+  snap.takenMs = millis();
+  xQueueOverwrite(sensorMailbox, &snap);
+
+  // --- 控制週期 ---
+  uint64_t ctlNs = 0;
+  for (int i = 0; i < iterations; i++) {
+    hostClockAdvance(controlPeriodMs * 1000);
+    uint64_t c0 = realNs();
+    controlCycle(millis());
+    ctlNs += realNs() - c0;
+  }
+  report("control_cycle", iterations, ctlNs);
+
+  // --- MQTT 指令 (解析 + 放進指令佇列；佇列每次直接清空，不計入) ---
+  static const char* const payloads[] = {
+    "AUTO_ON",
+    "VALVE3_OFF",
+    "{\"cmd\":\"PUMP_RUN\",\"sec\":120}",
+    "{\"cmd\":\"SET\",\"soil_low\":25,\"soil_high\":75}",
+    "STOP",
+  };
+  const int payloadCount = sizeof(payloads) / sizeof(payloads[0]);
+  char topic[] = "farm/control";
+  uint64_t cbNs = 0;
+  for (int i = 0; i < iterations; i++) {
+    const char* p = payloads[i % payloadCount];
+    uint64_t c0 = realNs();
+    callback(topic, (byte*)p, strlen(p));
+    cbNs += realNs() - c0;
+    FarmCmd cmd;
+    while (xQueueReceive(cmdQueue, &cmd, 0) == pdTRUE) {}
+  }
+  report("callback", iterations, cbNs);
+
+  // --- 韌體內建的量測 (發佈到 farm/metrics) ---
+  client.hostPublished.clear();
+  runTickBenchmark();
+  runParseBenchmark();
+  for (const HostPublish& m : client.hostPublished) printf("%s\n", m.payload.c_str());
+  return 0;
+}
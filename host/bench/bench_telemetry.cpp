@@ -0,0 +1,97 @@
+// ==========================================
+//  主機端遙測序列化量測 (farm/monitor)：
+//  舊版 String 串接 vs 固定緩衝 writeTelemetryJson() vs 二進位 packTelemetry()
+//  每種輸出每筆的位元組數、ns 與 heap 配置次數；
+//  writer 與 String 的 JSON 不一致、或 writer / 二進位有配置記憶體時回傳 1
+//  用法：bench_telemetry [筆數 (預設 200000)]
+// ==========================================
+#include "v11.0.cpp"
+
+#include <chrono>
+#include "host.h"
+
+static uint64_t realNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// v11.0 原本 loop() 裡的寫法
+static String telemetryString(const FarmTelemetry& t) {
+  return "{\"temp\":" + String(t.airTemp, 1) +
+         ",\"hum\":" + String(t.airHum, 1) +
+         ",\"soil_hum\":" + String(t.soilHum, 1) +
+         ",\"soil_temp\":" + String(t.soilTemp, 1) +
+         ",\"ec\":" + String(t.ec) +
+         ",\"salinity\":" + String(t.salinity) +
+         ",\"status\":" + String(t.status) + "}";
+}
+
+// 每筆數值都不同 (含負溫度、0 與整數邊界)，避免被最佳化成常數
+static FarmTelemetry sample(int i) {
+  FarmTelemetry t;
+  t.airTemp = -5.0f + (i % 450) * 0.1f;
+  t.airHum = (i * 7 % 1000) * 0.1f;
+  t.soilHum = (i * 13 % 1000) * 0.1f;
+  t.soilTemp = 10.0f + (i * 3 % 300) * 0.1f;
+  t.ec = i * 37 % 5000;
+  t.salinity = i * 11 % 2000;
+  t.status = i % 64;
+  return t;
+}
+
+static void report(const char* name, int n, uint64_t bytes, uint64_t ns, uint32_t allocs) {
+  printf("{\"bench\":\"telemetry_host\",\"encoder\":\"%s\",\"samples\":%d,\"bytes_per_sample\":%.1f"
+         ",\"ns_per_sample\":%.1f,\"allocs_per_sample\":%.2f}\n",
+         name, n, (double)bytes / n, (double)ns / n, (double)allocs / n);
+}
+
+int main(int argc, char** argv) {
+  int n = argc > 1 ? atoi(argv[1]) : 200000;
+  if (n <= 0) n = 1;
+  bool ok = true;
+
+  // 內容比對：writer 必須與 String 版逐字相同
+  int mismatches = 0;
+  for (int i = 0; i < 5000; i++) {
+    FarmTelemetry t = sample(i);
+    char buf[160];
+    size_t len = writeTelemetryJson(t, buf, sizeof(buf));
+    String s = telemetryString(t);
+    if (len != s.length() || memcmp(buf, s.c_str(), len) != 0) {
+      if (mismatches++ < 3) printf("不一致：writer=%.*s string=%s\n", (int)len, buf, s.c_str());
+    }
+  }
+  ok &= mismatches == 0;
+
+  uint64_t bytes = 0;
+  uint32_t a0 = hostHeapAllocs();
+  uint64_t t0 = realNs();
+  for (int i = 0; i < n; i++) bytes += telemetryString(sample(i)).length();
+  report("string", n, bytes, realNs() - t0, hostHeapAllocs() - a0);
+
+  char buf[160];
+  bytes = 0;
+  a0 = hostHeapAllocs();
+  t0 = realNs();
+  for (int i = 0; i < n; i++) {
+    bytes += writeTelemetryJson(sample(i), buf, sizeof(buf));
+    __asm__ __volatile__("" : : "r"(buf) : "memory");
+  }
+  uint32_t writerAllocs = hostHeapAllocs() - a0;
+  report("writer", n, bytes, realNs() - t0, writerAllocs);
+
+  uint8_t bin[TELEMETRY_BIN_SIZE];
+  bytes = 0;
+  a0 = hostHeapAllocs();
+  t0 = realNs();
+  for (int i = 0; i < n; i++) {
+    bytes += packTelemetry(sample(i), bin);
+    __asm__ __volatile__("" : : "r"(bin) : "memory");
+  }
+  uint32_t binAllocs = hostHeapAllocs() - a0;
+  report("binary", n, bytes, realNs() - t0, binAllocs);
+
+  ok &= writerAllocs == 0 && binAllocs == 0;
+  printf("{\"mismatches\":%d,\"ok\":%d}\n", mismatches, ok ? 1 : 0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+// ==========================================
+//  主機端 Arduino 墊片
+//  讓 cpp/v11.0.cpp 不改一行就能在 Linux 上編譯、測試、量測 (perf / valgrind)。
+//  - 時間：虛擬時鐘，只有 delay()、vTaskDelay() 與 hostClockAdvance() 會推進，
+//    結果可以重現；ESP.getCycleCount() 例外，取實際時間 (換算 240 MHz)，供韌體內建的 benchmark 使用
+//  - GPIO：記在陣列裡的電位，下降緣可由測試注入並觸發 gpio_isr_handler_add() 掛上的 ISR
+//  - HardwareSerial：模擬 UART，寫出的位元組交給測試端的 peer，回應依鮑率逐字元送達
+//  測試端用到的控制介面在 host.h
+// ==========================================
+#pragma once
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define OUTPUT_OPEN_DRAIN 0x12
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define DEC 10
+#define HEX 16
+#define PI 3.1415926535897932384626433832795
+#define SERIAL_8N1 0x800001c
+
+// --- 時間 (虛擬時鐘) ---
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// --- GPIO ---
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+// --- String (以 std::string 實作，配置走一般的 heap，ESP.getFreeHeap() 量得到) ---
+class String {
+ public:
+  String(const char* s = "") : s(s ? s : "") {}
+  String(const std::string& s) : s(s) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(int v, unsigned char base = DEC) : s(fmtInt(v, base)) {}
+  explicit String(unsigned v, unsigned char base = DEC) : s(fmtUnsigned(v, base)) {}
+  explicit String(long v, unsigned char base = DEC) : s(fmtInt(v, base)) {}
+  explicit String(unsigned long v, unsigned char base = DEC) : s(fmtUnsigned(v, base)) {}
+  explicit String(float v, unsigned char decimals = 2) : s(fmtFloat(v, decimals)) {}
+  explicit String(double v, unsigned char decimals = 2) : s(fmtFloat(v, decimals)) {}
+
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String& operator+=(const char* o) { s += o; return *this; }
+  String& operator+=(char c) { s += c; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+  friend String operator+(const String& a, const char* b) { return String(a.s + b); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.s); }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator==(const char* o) const { return s == o; }
+  bool operator!=(const String& o) const { return s != o.s; }
+  char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+
+  const char* c_str() const { return s.c_str(); }
+  unsigned length() const { return s.size(); }
+  bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+  bool endsWith(const String& p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+  int indexOf(char c) const { size_t i = s.find(c); return i == std::string::npos ? -1 : (int)i; }
+  String substring(unsigned from, unsigned to) const { return String(s.substr(from, to > from ? to - from : 0)); }
+  long toInt() const { return atol(s.c_str()); }
+  void trim();
+
+ private:
+  std::string s;
+  static std::string fmtInt(long v, unsigned char base);
+  static std::string fmtUnsigned(unsigned long v, unsigned char base);
+  static std::string fmtFloat(double v, unsigned char decimals);
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len) {
+    size_t n = 0;
+    while (len--) n += write(*buf++);
+    return n;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+  size_t print(double v, int decimals = 2) { return print(String(v, (unsigned char)decimals)); }
+  size_t println() { return write("\r\n"); }
+  size_t println(const char* s) { return print(s) + println(); }
+  size_t println(const String& s) { return print(s) + println(); }
+  size_t println(long v, int base = DEC) { return print(v, base) + println(); }
+  size_t println(double v, int decimals = 2) { return print(v, decimals) + println(); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long ms) { timeoutMs = ms; }
+  size_t readBytes(uint8_t* buf, size_t len);
+
+ protected:
+  unsigned long timeoutMs = 1000;
+};
+
+// --- HardwareSerial：模擬 UART ---
+typedef enum { UART_MODE_UART = 0, UART_MODE_RS485_HALF_DUPLEX = 1 } SerialMode;
+
+class HardwareSerial : public Stream {
+ public:
+  // 對端 (例如模擬的 Modbus 從站)：收到主機寫出的位元組時呼叫，可用 hostReply() 安排回應
+  typedef std::function<void(HardwareSerial&, const uint8_t*, size_t)> Peer;
+
+  explicit HardwareSerial(int uartNum);
+  ~HardwareSerial();
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1,
+             bool invert = false, unsigned long timeoutMs = 20000UL, uint8_t rxfifoFullThrhd = 112);
+  void end() {}
+  bool setPins(int8_t rx, int8_t tx, int8_t cts = -1, int8_t rts = -1) { return true; }
+  bool setMode(SerialMode mode) { return true; }
+  bool setRxTimeout(uint8_t symbols) { rxTimeoutSymbols = symbols; return true; }
+  size_t setRxBufferSize(size_t n) { return n; }
+  size_t setTxBufferSize(size_t n) { return n; }
+  void onReceive(void (*fn)(void), bool onlyOnTimeout = false) { onRx = fn; onRxTimeoutOnly = onlyOnTimeout; }
+  operator bool() const { return true; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t len) override;
+  using Print::write;
+  void flush() override {}
+
+  // --- 測試端介面 ---
+  void hostSetPeer(Peer p) { peer = p; }
+  // 從現在起 delayUs 之後開始送達，之後每個字元間隔一個字元時間
+  void hostReply(const uint8_t* buf, size_t len, uint32_t delayUs = 0);
+  void hostInject(const uint8_t* buf, size_t len) { hostReply(buf, len, 0); }
+  uint32_t hostCharUs() const { return charUs; }
+  std::vector<uint8_t> hostTx;   // 累計寫出的位元組 (測試可清空)
+  // 時鐘推進時由墊片呼叫：把已送達的位元組放進接收緩衝，必要時觸發 RX 逾時回調
+  void hostPump();
+
+ private:
+  int uartNum;
+  uint32_t charUs = 1146;        // 9600 bps, 11 bits
+  uint8_t rxTimeoutSymbols = 2;
+  uint64_t txBusyUntil = 0;
+  std::deque<std::pair<uint64_t, uint8_t>> incoming; // (送達時間, 位元組)
+  std::deque<uint8_t> rxBuf;
+  uint64_t lastArrivalUs = 0;
+  bool gapPending = false;
+  void (*onRx)(void) = nullptr;
+  bool onRxTimeoutOnly = false;
+  Peer peer;
+};
+
+extern HardwareSerial Serial;
+
+class IPAddress {
+ public:
+  IPAddress() : addr(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+  IPAddress(uint32_t a) : addr(a) {}
+  operator uint32_t() const { return addr; }
+  String toString() const;
+
+ private:
+  uint32_t addr;
+};
+
+class EspClass {
+ public:
+  void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getPsramSize() { return 0; }
+};
+
+extern EspClass ESP;
+
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1,
+                const char* server2 = nullptr, const char* server3 = nullptr);
+
+bool psramFound();
+void* ps_malloc(size_t size);
+
+#define ARDUINO_RUNNING_CORE 1
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
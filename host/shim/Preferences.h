@@ -0,0 +1,41 @@
+// 主機端 NVS 墊片：記憶體裡的鍵值表，跨 begin()/end() 保留 (模擬重開機後讀回)
+#pragma once
+#include "Arduino.h"
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool readOnly = false);
+  void end() { ns.clear(); }
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+
+  size_t putBool(const char* key, bool v) { return putRaw(key, &v, sizeof(v)); }
+  size_t putUChar(const char* key, uint8_t v) { return putRaw(key, &v, sizeof(v)); }
+  size_t putInt(const char* key, int32_t v) { return putRaw(key, &v, sizeof(v)); }
+  size_t putUInt(const char* key, uint32_t v) { return putRaw(key, &v, sizeof(v)); }
+  size_t putBytes(const char* key, const void* v, size_t len) { return putRaw(key, v, len); }
+  bool getBool(const char* key, bool def = false) { return getScalar(key, def); }
+  uint8_t getUChar(const char* key, uint8_t def = 0) { return getScalar(key, def); }
+  int32_t getInt(const char* key, int32_t def = 0) { return getScalar(key, def); }
+  uint32_t getUInt(const char* key, uint32_t def = 0) { return getScalar(key, def); }
+  size_t getBytesLength(const char* key);
+  size_t getBytes(const char* key, void* buf, size_t maxLen);
+
+  // --- 測試端介面 ---
+  static uint32_t hostWrites;   // 實際寫入次數 (flash 磨耗)
+  static void hostErase();      // 清空所有命名空間 (模擬全新的晶片)
+
+ private:
+  std::string ns;
+  size_t putRaw(const char* key, const void* v, size_t len);
+  const std::vector<uint8_t>* find(const char* key);
+  template <typename T>
+  T getScalar(const char* key, T def) {
+    const std::vector<uint8_t>* v = find(key);
+    if (!v || v->size() != sizeof(T)) return def;
+    T out;
+    memcpy(&out, v->data(), sizeof(T));
+    return out;
+  }
+};
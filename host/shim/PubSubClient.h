@@ -0,0 +1,47 @@
+// 主機端 MQTT 墊片：不連線，發佈的內容記在 hostPublished，測試可直接檢查
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+struct HostPublish {
+  std::string topic;
+  std::string payload;
+};
+
+class PubSubClient {
+ public:
+  explicit PubSubClient(Client& c) {}
+  PubSubClient& setServer(const char* domain, uint16_t port) { return *this; }
+  PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+  PubSubClient& setSocketTimeout(uint16_t sec) { return *this; }
+  PubSubClient& setKeepAlive(uint16_t sec) { return *this; }
+  bool setBufferSize(uint16_t size) { bufferSize = size; return true; }
+  bool connect(const char* id, const char* user, const char* pass) { return hostConnected; }
+  bool connected() { return hostConnected; }
+  void disconnect() {}
+  bool loop() { return hostConnected; }
+  bool subscribe(const char* topic) { return hostConnected; }
+  int state() { return hostConnected ? 0 : -1; }
+
+  bool publish(const char* topic, const char* payload) { return publish(topic, (const uint8_t*)payload, strlen(payload)); }
+  bool publish(const char* topic, const uint8_t* payload, unsigned int len, bool retained = false);
+  bool beginPublish(const char* topic, unsigned int len, bool retained);
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t len);
+  int endPublish();
+
+  // --- 測試端介面 ---
+  bool hostConnected = true;
+  std::vector<HostPublish> hostPublished;
+  // 模擬 broker 送來一則訊息 (直接呼叫 setCallback() 設定的回調)
+  void hostDeliver(const char* topic, const char* payload);
+
+ private:
+  MQTT_CALLBACK_SIGNATURE = nullptr;
+  uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+  bool streaming = false;
+  HostPublish pending;
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+typedef enum { WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL = 1, WL_CONNECTED = 3, WL_CONNECT_FAILED = 4, WL_DISCONNECTED = 6 } wl_status_t;
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_CONNECTED = 4, ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7, ARDUINO_EVENT_WIFI_STA_LOST_IP = 8, ARDUINO_EVENT_MAX = 9
+} arduino_event_id_t;
+typedef union {
+  struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; } wifi_sta_disconnected;
+} arduino_event_info_t;
+typedef arduino_event_id_t WiFiEvent_t;
+typedef arduino_event_info_t WiFiEventInfo_t;
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t event, arduino_event_info_t info);
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+class WiFiClass {
+ public:
+  wl_status_t begin(const char* ssid, const char* password) { return WL_DISCONNECTED; }
+  wl_status_t status() { return WL_DISCONNECTED; }
+  bool disconnect(bool wifiOff = false, bool eraseAp = false) { return true; }
+  bool reconnect() { return false; }
+  int hostByName(const char* host, IPAddress& result) { return 0; }
+  bool mode(wifi_mode_t m) { return true; }
+  bool setAutoReconnect(bool on) { return true; }
+  bool setSleep(bool on) { return true; }
+  int onEvent(WiFiEventFuncCb cb, arduino_event_id_t event = ARDUINO_EVENT_MAX) { return 0; }
+  int8_t RSSI() { return 0; }
+  IPAddress localIP() { return IPAddress(); }
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,31 @@
+// 主機端網路墊片：沒有真的 socket，連線一律失敗，讓韌體走離線路徑
+#pragma once
+#include "Arduino.h"
+
+class Client : public Stream {
+ public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char* host, uint16_t port) = 0;
+  virtual int read(uint8_t* buf, size_t size) = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  using Stream::read;
+};
+
+class WiFiClient : public Client {
+ public:
+  int connect(IPAddress ip, uint16_t port) override { return 0; }
+  int connect(const char* host, uint16_t port) override { return 0; }
+  size_t write(uint8_t c) override { return 0; }
+  size_t write(const uint8_t* buf, size_t len) override { return 0; }
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int read(uint8_t* buf, size_t size) override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+  void stop() override {}
+  uint8_t connected() override { return 0; }
+  operator bool() { return false; }
+  int setNoDelay(bool nodelay) { return 0; }
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include "WiFiClient.h"
+
+class WiFiClientSecure : public WiFiClient {
+ public:
+  using WiFiClient::connect;
+  int connect(IPAddress ip, uint16_t port, const char* host, const char* caCert, const char* cert, const char* key) { return 0; }
+  void setInsecure() {}
+  void setCACert(const char* cert) {}
+  void setHandshakeTimeout(unsigned long sec) {}
+  int lastError(char* buf, size_t size) { if (size) buf[0] = '\0'; return 0; }
+};
@@ -0,0 +1,328 @@
+// 主機端 Arduino 墊片：時鐘、GPIO、String / Print、模擬 UART、ESP 物件、heap 計數
+#include <malloc.h>
+#include <stdarg.h>
+#include <chrono>
+#include <new>
+#include "Arduino.h"
+#include "host.h"
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+
+// ==========================================
+//  虛擬時鐘
+//  millis() / micros() 與 ESP32 一樣是 32 位元 (unsigned long 在主機上是 64 位元，
+//  這裡先截斷)；超過約 71 分鐘 micros() 會繞回，跨越繞回點的減法結果與實機不同
+// ==========================================
+static uint64_t nowUs = 0;
+
+static std::vector<HardwareSerial*>& uartList() {
+  static std::vector<HardwareSerial*> list;
+  return list;
+}
+
+uint64_t hostClockUs() { return nowUs; }
+
+void hostClockAdvance(uint64_t us) {
+  uint64_t end = nowUs + us;
+  // 逐字元推進，RX 逾時回調才會在正確的時間點觸發
+  while (nowUs < end) {
+    uint64_t step = end - nowUs;
+    if (step > 500) step = 500;
+    nowUs += step;
+    for (HardwareSerial* u : uartList()) u->hostPump();
+  }
+}
+
+unsigned long millis() { return (uint32_t)(nowUs / 1000); }
+unsigned long micros() { return (uint32_t)nowUs; }
+void delay(uint32_t ms) { hostClockAdvance((uint64_t)ms * 1000); }
+void delayMicroseconds(uint32_t us) { hostClockAdvance(us); }
+int64_t esp_timer_get_time() { return (int64_t)nowUs; }
+
+static uint32_t realCycles() {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  return (uint32_t)((uint64_t)ns * 240 / 1000);
+}
+
+uint32_t esp_cpu_get_cycle_count() { return realCycles(); }
+
+// ==========================================
+//  GPIO
+// ==========================================
+#define HOST_GPIO_PINS 40
+
+struct HostPin {
+  uint8_t mode;
+  int level;
+  bool driven;              // 測試端驅動中，上拉不覆蓋
+  gpio_int_type_t intr;
+  gpio_isr_t isr;
+  void* arg;
+};
+
+static HostPin pins[HOST_GPIO_PINS];
+gpio_dev_t GPIO;
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= HOST_GPIO_PINS) return;
+  pins[pin].mode = mode;
+  if (mode == INPUT_PULLUP && !pins[pin].driven) pins[pin].level = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < HOST_GPIO_PINS) pins[pin].level = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) { return pin < HOST_GPIO_PINS ? pins[pin].level : LOW; }
+
+int hostGpioLevel(uint8_t pin) { return digitalRead(pin); }
+
+void hostGpioDrive(uint8_t pin, int level) {
+  if (pin >= HOST_GPIO_PINS) return;
+  HostPin& p = pins[pin];
+  int old = p.level;
+  p.level = level ? HIGH : LOW;
+  p.driven = true;
+  if (!p.isr || old == p.level) return;
+  bool fire = p.intr == GPIO_INTR_ANYEDGE ||
+              (p.intr == GPIO_INTR_NEGEDGE && p.level == LOW) ||
+              (p.intr == GPIO_INTR_POSEDGE && p.level == HIGH);
+  if (fire) p.isr(p.arg);
+}
+
+HostGpioSetReg& HostGpioSetReg::operator=(uint32_t mask) {
+  for (int i = 0; i < 32; i++) {
+    if (mask & (1UL << i)) pins[i].level = set ? HIGH : LOW;
+  }
+  return *this;
+}
+
+static bool isrServiceInstalled = false;
+
+esp_err_t gpio_install_isr_service(int intrAllocFlags) {
+  if (isrServiceInstalled) return ESP_ERR_INVALID_STATE;
+  isrServiceInstalled = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type) {
+  if (pin < 0 || pin >= HOST_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+  pins[pin].intr = type;
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void* arg) {
+  if (!isrServiceInstalled) return ESP_ERR_INVALID_STATE;
+  if (pin < 0 || pin >= HOST_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+  pins[pin].isr = handler;
+  pins[pin].arg = arg;
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t pin) {
+  if (pin < 0 || pin >= HOST_GPIO_PINS) return ESP_ERR_INVALID_ARG;
+  pins[pin].isr = nullptr;
+  return ESP_OK;
+}
+
+// ==========================================
+//  亂數 (固定種子，結果可重現)
+// ==========================================
+static uint32_t rngState = 0x12345678;
+
+uint32_t esp_random(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+long random(long howbig) { return howbig > 0 ? (long)(esp_random() % (uint32_t)howbig) : 0; }
+long random(long howsmall, long howbig) { return howbig > howsmall ? howsmall + random(howbig - howsmall) : howsmall; }
+
+// ==========================================
+//  String / Print / Stream
+// ==========================================
+std::string String::fmtInt(long v, unsigned char base) {
+  if (v < 0 && base == DEC) return "-" + fmtUnsigned((unsigned long)-v, base);
+  return fmtUnsigned((unsigned long)v, base);
+}
+
+std::string String::fmtUnsigned(unsigned long v, unsigned char base) {
+  char buf[72];
+  char* p = buf + sizeof(buf);
+  *--p = '\0';
+  do {
+    unsigned d = v % base;
+    *--p = d < 10 ? '0' + d : 'A' + d - 10;
+    v /= base;
+  } while (v);
+  return p;
+}
+
+std::string String::fmtFloat(double v, unsigned char decimals) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+  return buf;
+}
+
+void String::trim() {
+  size_t b = 0, e = s.size();
+  while (b < e && isspace((unsigned char)s[b])) b++;
+  while (e > b && isspace((unsigned char)s[e - 1])) e--;
+  s = s.substr(b, e - b);
+}
+
+size_t Print::printf(const char* fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n < 0) return 0;
+  return write((const uint8_t*)buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+size_t Stream::readBytes(uint8_t* buf, size_t len) {
+  size_t n = 0;
+  while (n < len && available() > 0) buf[n++] = (uint8_t)read();
+  return n;
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", addr & 0xFF, (addr >> 8) & 0xFF, (addr >> 16) & 0xFF, addr >> 24);
+  return String(buf);
+}
+
+// ==========================================
+//  模擬 UART
+//  UART0 (Serial) 設定環境變數 FARM_HOST_SERIAL=1 時印到 stdout，否則丟掉；
+//  其他 UART 寫出的位元組記在 hostTx 並交給 peer
+// ==========================================
+HardwareSerial Serial(0);
+
+HardwareSerial::HardwareSerial(int uartNum) : uartNum(uartNum) { uartList().push_back(this); }
+
+HardwareSerial::~HardwareSerial() {
+  std::vector<HardwareSerial*>& l = uartList();
+  l.erase(std::remove(l.begin(), l.end(), this), l.end());
+}
+
+void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin, bool invert,
+                           unsigned long timeoutMs, uint8_t rxfifoFullThrhd) {
+  if (baud) charUs = 11000000UL / baud;
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t len) {
+  if (uartNum == 0) {
+    static const bool echo = getenv("FARM_HOST_SERIAL") != nullptr;
+    if (echo) fwrite(buf, 1, len, stdout);
+    return len;
+  }
+  hostTx.insert(hostTx.end(), buf, buf + len);
+  txBusyUntil = std::max(txBusyUntil, nowUs) + (uint64_t)len * charUs;
+  if (peer) peer(*this, buf, len);
+  return len;
+}
+
+void HardwareSerial::hostReply(const uint8_t* buf, size_t len, uint32_t delayUs) {
+  uint64_t t = std::max(txBusyUntil, nowUs) + delayUs;
+  if (!incoming.empty()) t = std::max(t, incoming.back().first);
+  for (size_t i = 0; i < len; i++) {
+    t += charUs;
+    incoming.push_back(std::make_pair(t, buf[i]));
+  }
+}
+
+void HardwareSerial::hostPump() {
+  bool arrived = false;
+  while (!incoming.empty() && incoming.front().first <= nowUs) {
+    rxBuf.push_back(incoming.front().second);
+    lastArrivalUs = incoming.front().first;
+    incoming.pop_front();
+    arrived = true;
+  }
+  if (arrived) {
+    gapPending = true;
+    if (onRx && !onRxTimeoutOnly) onRx();
+  }
+  if (gapPending && incoming.empty() && nowUs >= lastArrivalUs + (uint64_t)rxTimeoutSymbols * charUs) {
+    gapPending = false;
+    if (onRx) onRx();
+  }
+}
+
+int HardwareSerial::available() {
+  hostPump();
+  return (int)rxBuf.size();
+}
+
+int HardwareSerial::read() {
+  hostPump();
+  if (rxBuf.empty()) return -1;
+  uint8_t c = rxBuf.front();
+  rxBuf.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() {
+  hostPump();
+  return rxBuf.empty() ? -1 : rxBuf.front();
+}
+
+// ==========================================
+//  ESP 物件與 heap 計數
+//  全域 operator new / delete 記錄配置中的位元組，ESP.getFreeHeap() 由此推算，
+//  String 與固定緩衝的配置差異在主機上也量得出來
+// ==========================================
+EspClass ESP;
+uint32_t hostRestarts = 0;
+
+static const size_t hostHeapSize = 320 * 1024;   // 約等於 ESP32 開機後可用的 DRAM
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+static uint32_t heapAllocs = 0;
+
+void* operator new(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  heapInUse += malloc_usable_size(p);
+  if (heapInUse > heapPeak) heapPeak = heapInUse;
+  heapAllocs++;
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept {
+  if (!p) return;
+  heapInUse -= malloc_usable_size(p);
+  free(p);
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+size_t hostHeapInUse() { return heapInUse; }
+uint32_t hostHeapAllocs() { return heapAllocs; }
+
+void EspClass::restart() { hostRestarts++; }
+uint32_t EspClass::getFreeHeap() { return heapInUse < hostHeapSize ? hostHeapSize - heapInUse : 0; }
+uint32_t EspClass::getMaxAllocHeap() { return getFreeHeap(); }
+uint32_t EspClass::getMinFreeHeap() { return heapPeak < hostHeapSize ? hostHeapSize - heapPeak : 0; }
+uint32_t EspClass::getCycleCount() { return realCycles(); }
+
+bool psramFound() { return false; }
+void* ps_malloc(size_t size) { return malloc(size); }
+
+// 時間直接用主機的系統時間 (本地時區)；韌體只在 NTP 對時後才會用到
+bool getLocalTime(struct tm* info, uint32_t ms) {
+  time_t now = time(nullptr);
+  localtime_r(&now, info);
+  return info->tm_year > (2016 - 1900);
+}
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char* server1, const char* server2, const char* server3) {}
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// 實際經過時間換算成 240 MHz 的 cycle 數
+uint32_t esp_cpu_get_cycle_count();
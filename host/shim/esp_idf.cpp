@@ -0,0 +1,62 @@
+// 主機端 ESP-IDF 墊片：flash 分割區與系統函式
+#include "Arduino.h"
+#include "host.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+
+// ==========================================
+//  flash 分割區
+//  只有一個 64 KB 的 "tlog"；抹除以 4 KB 磁區為單位把內容設成 0xFF，
+//  寫入只能把位元從 1 清成 0 (與 NOR flash 相同)，未抹除就覆寫的錯誤在主機上也看得出來
+// ==========================================
+#define HOST_FLASH_SIZE (64 * 1024)
+#define HOST_FLASH_SECTOR 4096
+
+static uint8_t flash[HOST_FLASH_SIZE];
+static bool flashReady = false;
+static const esp_partition_t tlogPartition = { ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, 0x310000, HOST_FLASH_SIZE, "tlog" };
+
+uint8_t* hostFlash() {
+  if (!flashReady) { memset(flash, 0xFF, sizeof(flash)); flashReady = true; }
+  return flash;
+}
+
+size_t hostFlashSize() { return HOST_FLASH_SIZE; }
+
+uint32_t hostFlashFailWrites = 0;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+  if (type != ESP_PARTITION_TYPE_DATA || !label || strcmp(label, tlogPartition.label) != 0) return nullptr;
+  hostFlash();
+  return &tlogPartition;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* part, size_t offset, size_t size, esp_partition_mmap_memory_t memory,
+                             const void** outPtr, esp_partition_mmap_handle_t* outHandle) {
+  if (part != &tlogPartition || offset + size > HOST_FLASH_SIZE) return ESP_ERR_INVALID_ARG;
+  *outPtr = hostFlash() + offset;
+  *outHandle = 1;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* part, size_t dstOffset, const void* src, size_t size) {
+  if (part != &tlogPartition || dstOffset + size > HOST_FLASH_SIZE) return ESP_ERR_INVALID_SIZE;
+  if (hostFlashFailWrites) { hostFlashFailWrites--; return ESP_FAIL; }
+  const uint8_t* s = (const uint8_t*)src;
+  uint8_t* d = hostFlash() + dstOffset;
+  for (size_t i = 0; i < size; i++) d[i] &= s[i];
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* part, size_t offset, size_t size) {
+  if (part != &tlogPartition || offset + size > HOST_FLASH_SIZE) return ESP_ERR_INVALID_SIZE;
+  if (offset % HOST_FLASH_SECTOR || size % HOST_FLASH_SECTOR) return ESP_ERR_INVALID_ARG;
+  memset(hostFlash() + offset, 0xFF, size);
+  return ESP_OK;
+}
+
+// ==========================================
+//  系統
+// ==========================================
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler) { return ESP_OK; }
+esp_reset_reason_t esp_reset_reason(void) { return ESP_RST_POWERON; }
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// 虛擬時鐘 (µs)
+int64_t esp_timer_get_time();
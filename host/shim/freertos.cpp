@@ -0,0 +1,116 @@
+// 主機端 FreeRTOS 墊片：任務只留下名稱與通知計數，佇列與號誌照語意實作。
+// 拿不到資料時不會阻塞，而是把虛擬時鐘推進等待時間後回傳失敗 (與逾時的結果相同)
+#include <string>
+#include "Arduino.h"
+#include "host.h"
+
+struct HostTask {
+  std::string name;
+  uint32_t notify;
+};
+
+struct HostQueue {
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+TaskHandle_t hostCurrentTask = nullptr;
+static HostTask mainTask = { "main", 0 };
+
+static void waitTicks(TickType_t wait) {
+  if (wait != portMAX_DELAY) hostClockAdvance((uint64_t)wait * 1000);
+}
+
+// --- 任務 ---
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  HostTask* t = new HostTask{ name, 0 };
+  if (handle) *handle = t;
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+void vTaskDelay(TickType_t ticks) { waitTicks(ticks); }
+
+BaseType_t xTaskDelayUntil(TickType_t* previousWake, TickType_t period) {
+  uint64_t target = (uint64_t)(*previousWake + period) * 1000;
+  *previousWake += period;
+  if (target <= hostClockUs()) return pdFALSE;
+  hostClockAdvance(target - hostClockUs());
+  return pdTRUE;
+}
+
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t period) { xTaskDelayUntil(previousWake, period); }
+TickType_t xTaskGetTickCount() { return (TickType_t)(hostClockUs() / 1000); }
+TaskHandle_t xTaskGetCurrentTaskHandle() { return hostCurrentTask; }
+const char* pcTaskGetName(TaskHandle_t task) { return (task ? task : &mainTask)->name.c_str(); }
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 1024; }
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  if (task) task->notify++;
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+  xTaskNotifyGive(task);
+  if (woken) *woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+  HostTask* t = hostCurrentTask ? hostCurrentTask : &mainTask;
+  if (t->notify == 0) waitTicks(wait);
+  uint32_t n = t->notify;
+  if (n) t->notify = clearOnExit ? 0 : n - 1;
+  return n;
+}
+
+uint32_t hostTaskNotifyCount(TaskHandle_t task) { return task ? task->notify : 0; }
+
+// --- 佇列 ---
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  return new HostQueue{ length, itemSize, {} };
+}
+
+void vQueueDelete(QueueHandle_t q) { delete q; }
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t wait) {
+  if (q->items.size() >= q->length) { waitTicks(wait); return pdFAIL; }
+  const uint8_t* p = (const uint8_t*)item;
+  q->items.push_back(std::vector<uint8_t>(p, p + q->itemSize));
+  return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void* item, BaseType_t* woken) { return xQueueSend(q, item, 0); }
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void* item) {
+  q->items.clear();
+  return xQueueSend(q, item, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void* item, TickType_t wait) {
+  if (q->items.empty()) { waitTicks(wait); return pdFAIL; }
+  if (q->itemSize && item) memcpy(item, q->items.front().data(), q->itemSize);
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) {
+  if (!xQueuePeek(q, item, wait)) return pdFAIL;
+  q->items.pop_front();
+  return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) { return q->items.size(); }
+
+// --- 號誌：長度 1、項目大小 0 的佇列 ---
+SemaphoreHandle_t xSemaphoreCreateBinary() { return xQueueCreate(1, 0); }
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SemaphoreHandle_t m = xSemaphoreCreateBinary();
+  xSemaphoreGive(m);
+  return m;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) { return xQueueReceive(sem, nullptr, wait); }
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { return xQueueSend(sem, nullptr, 0); }
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t* woken) { return xSemaphoreGive(sem); }
@@ -0,0 +1,34 @@
+// 主機端 FreeRTOS 墊片：單執行緒，任務不會真的執行 (測試直接呼叫任務裡的函式)，
+// 佇列、號誌、任務通知則照語意實作；需要等待時推進虛擬時鐘而不是阻塞
+#pragma once
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t StackType_t;
+
+struct HostTask;
+struct HostQueue;
+typedef HostTask* TaskHandle_t;
+typedef HostQueue* QueueHandle_t;
+typedef HostQueue* SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffu
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+#define tskIDLE_PRIORITY 0
+
+// 單執行緒：臨界區段不必上鎖
+typedef struct { uint32_t owner; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux) ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux) ((void)(mux))
+#define portYIELD_FROM_ISR(...) ((void)0)
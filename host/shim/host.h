@@ -0,0 +1,26 @@
+// ==========================================
+//  主機端測試 / 量測用的控制介面
+//  只給 host/test、host/bench 使用，韌體本身不會 include 這個檔案
+// ==========================================
+#pragma once
+#include <stdint.h>
+#include "Arduino.h"
+
+// --- 虛擬時鐘 ---
+uint64_t hostClockUs();
+void hostClockAdvance(uint64_t us);   // 推進時間並讓模擬 UART 送達到期的位元組
+
+// --- GPIO ---
+int hostGpioLevel(uint8_t pin);
+// 由外部驅動輸入腳位；電位改變且符合 gpio_set_intr_type() 的邊緣時直接呼叫 ISR
+void hostGpioDrive(uint8_t pin, int level);
+
+// --- 其他 ---
+extern uint32_t hostRestarts;         // ESP.restart() 被呼叫的次數 (主機端不會真的重開)
+extern TaskHandle_t hostCurrentTask;  // xTaskGetCurrentTaskHandle() 的回傳值，預設 NULL
+uint32_t hostTaskNotifyCount(TaskHandle_t task);
+size_t hostHeapInUse();               // operator new 配置中的位元組
+uint32_t hostHeapAllocs();            // 累計 operator new 次數
+uint8_t* hostFlash();                 // "tlog" 分割區的內容
+size_t hostFlashSize();
+extern uint32_t hostFlashFailWrites;  // 接下來幾次 esp_partition_write() 回傳 ESP_FAIL (不改內容)
@@ -0,0 +1,106 @@
+// 主機端網路與 NVS 墊片
+#include <map>
+#include "Arduino.h"
+#include "WiFi.h"
+#include "PubSubClient.h"
+#include "Preferences.h"
+
+WiFiClass WiFi;
+
+// ==========================================
+//  PubSubClient
+// ==========================================
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int len, bool retained) {
+  if (!hostConnected) return false;
+  hostPublished.push_back(HostPublish{ topic, std::string((const char*)payload, len) });
+  return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int len, bool retained) {
+  if (!hostConnected) return false;
+  pending.topic = topic;
+  pending.payload.clear();
+  pending.payload.reserve(len);
+  streaming = true;
+  return true;
+}
+
+size_t PubSubClient::write(const uint8_t* buf, size_t len) {
+  if (!streaming) return 0;
+  pending.payload.append((const char*)buf, len);
+  return len;
+}
+
+int PubSubClient::endPublish() {
+  if (!streaming) return 0;
+  streaming = false;
+  hostPublished.push_back(pending);
+  return 1;
+}
+
+void PubSubClient::hostDeliver(const char* topic, const char* payload) {
+  if (!callback) return;
+  std::vector<uint8_t> buf(payload, payload + strlen(payload));
+  std::string t = topic;
+  callback(&t[0], buf.data(), buf.size());
+}
+
+// ==========================================
+//  Preferences
+// ==========================================
+typedef std::map<std::string, std::vector<uint8_t>> HostNamespace;
+
+static std::map<std::string, HostNamespace>& nvs() {
+  static std::map<std::string, HostNamespace> store;
+  return store;
+}
+
+uint32_t Preferences::hostWrites = 0;
+
+void Preferences::hostErase() { nvs().clear(); }
+
+bool Preferences::begin(const char* name, bool readOnly) {
+  ns = name;
+  nvs()[ns];
+  return true;
+}
+
+bool Preferences::clear() {
+  if (ns.empty()) return false;
+  nvs()[ns].clear();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (ns.empty()) return false;
+  return nvs()[ns].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) { return find(key) != nullptr; }
+
+const std::vector<uint8_t>* Preferences::find(const char* key) {
+  if (ns.empty()) return nullptr;
+  HostNamespace& n = nvs()[ns];
+  HostNamespace::const_iterator it = n.find(key);
+  return it == n.end() ? nullptr : &it->second;
+}
+
+size_t Preferences::putRaw(const char* key, const void* v, size_t len) {
+  if (ns.empty()) return 0;
+  const uint8_t* p = (const uint8_t*)v;
+  nvs()[ns][key] = std::vector<uint8_t>(p, p + len);
+  hostWrites++;
+  return len;
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  const std::vector<uint8_t>* v = find(key);
+  return v ? v->size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) {
+  const std::vector<uint8_t>* v = find(key);
+  if (!v || v->size() > maxLen) return 0;
+  memcpy(buf, v->data(), v->size());
+  return v->size();
+}
@@ -0,0 +1,15 @@
+// GPIO.out_w1tc / out_w1ts：寫入時清除 / 設定墊片記錄的輸出電位
+#pragma once
+#include <stdint.h>
+
+struct HostGpioSetReg {
+  bool set;
+  HostGpioSetReg& operator=(uint32_t mask);
+};
+
+struct gpio_dev_t {
+  HostGpioSetReg out_w1ts{ true };
+  HostGpioSetReg out_w1tc{ false };
+};
+
+extern gpio_dev_t GPIO;
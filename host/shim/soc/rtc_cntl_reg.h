@@ -0,0 +1,2 @@
+#pragma once
+#define RTC_CNTL_BROWN_OUT_REG 0
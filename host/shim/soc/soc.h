@@ -0,0 +1,2 @@
+#pragma once
+#define WRITE_PERI_REG(addr, val) ((void)(addr), (void)(val))
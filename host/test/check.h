@@ -0,0 +1,30 @@
+// 主機端測試用的最小檢查巨集：失敗時印出位置並計數，main() 以 checkResult() 作為結束碼
+#pragma once
+#include <stdio.h>
+
+static int checkFailures = 0;
+static int checkCount = 0;
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    checkCount++;                                                          \
+    if (!(cond)) {                                                         \
+      printf("%s:%d: CHECK(%s) 失敗\n", __FILE__, __LINE__, #cond);        \
+      checkFailures++;                                                     \
+    }                                                                      \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                     \
+  do {                                                                     \
+    checkCount++;                                                          \
+    long long va_ = (long long)(a), vb_ = (long long)(b);                  \
+    if (va_ != vb_) {                                                      \
+      printf("%s:%d: CHECK_EQ(%s, %s) 失敗：%lld != %lld\n", __FILE__, __LINE__, #a, #b, va_, vb_); \
+      checkFailures++;                                                     \
+    }                                                                      \
+  } while (0)
+
+static int checkResult(const char* name) {
+  printf("%s：%d 項檢查，%d 項失敗\n", name, checkCount, checkFailures);
+  return checkFailures ? 1 : 0;
+}
@@ -0,0 +1,99 @@
+// ==========================================
+//  MQTT 指令解析主機端測試：整數參數溢位、閥門編號範圍與錯誤回覆
+// ==========================================
+#include "v11.0.cpp"
+
+#include "check.h"
+#include "host.h"
+
+static bool toInt(const char* s, int32_t& out) {
+  return spanToInt({ s, strlen(s) }, out);
+}
+
+// 透過 MQTT 回調送出指令，回傳放進指令佇列的數量；error 為 farm/metrics 上的 cmd_error 回覆
+static int deliver(const char* payload, FarmCmd* cmd, std::string* error = nullptr) {
+  char topic[] = "farm/control";
+  client.hostPublished.clear();
+  callback(topic, (byte*)payload, strlen(payload));
+  int n = 0;
+  while (xQueueReceive(cmdQueue, cmd, 0) == pdTRUE) n++;
+  if (error) {
+    error->clear();
+    for (const HostPublish& m : client.hostPublished)
+      if (m.topic == topic_metrics && m.payload.find("cmd_error") != std::string::npos) *error = m.payload.c_str();
+  }
+  return n;
+}
+
+int main() {
+  setup();
+  client.hostConnected = true;
+
+  // spanToInt：int32_t 邊界內照常，超出就失敗
+  int32_t v = 7;
+  CHECK(toInt("2147483647", v));
+  CHECK_EQ(v, 2147483647);
+  CHECK(toInt("-2147483648", v));
+  CHECK_EQ(v, INT32_MIN);
+  CHECK(toInt("0", v));
+  CHECK_EQ(v, 0);
+  v = 7;
+  CHECK(!toInt("2147483648", v));
+  CHECK(!toInt("-2147483649", v));
+  CHECK(!toInt("4294967296", v));
+  CHECK(!toInt("99999999999", v));
+  CHECK(!toInt("-", v));
+  CHECK(!toInt("12a", v));
+  CHECK_EQ(v, 7);
+
+  // 兩塊 8 線圈的繼電器板：閥門 0 ~ 15
+  relayBoardCount = 2;
+  relayBoards[0].cfg = { 0x10, 8 };
+  relayBoards[1].cfg = { 0x11, 8 };
+
+  FarmCmd cmd = {};
+  std::string error;
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":15,\"on\":1}", &cmd, &error), 1);
+  CHECK_EQ(cmd.type, CMD_VALVE_ON);
+  CHECK_EQ(cmd.arg, 15);
+  CHECK(error.empty());
+  CHECK_EQ(deliver("VALVE0_OFF", &cmd), 1);
+  CHECK_EQ(cmd.type, CMD_VALVE_OFF);
+  CHECK_EQ(cmd.arg, 0);
+
+  // 超過線圈數；65537 以前會被截斷成 1
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":16,\"on\":1}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"valve_id\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":65537,\"on\":1}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"valve_id\"}");
+  CHECK_EQ(deliver("VALVE65537_ON", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"valve_id\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":-1,\"on\":1}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"valve_id\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":3}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"valve_args\"}");
+
+  // 溢位的參數：以前 4294967297 會變成 1
+  CHECK_EQ(deliver("{\"cmd\":\"VALVE\",\"id\":4294967297,\"on\":1}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"bad_arg\"}");
+  CHECK_EQ(deliver("VALVE4294967297_ON", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"bad_arg\"}");
+  CHECK_EQ(deliver("VALVE99999999999999999999_ON", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"bad_arg\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"PUMP_RUN\",\"sec\":4294967416}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"bad_arg\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"PUMP_RUN\",\"sec\":\"abc\"}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"bad_arg\"}");
+
+  // 其他範圍檢查也會回覆
+  CHECK_EQ(deliver("{\"cmd\":\"PUMP_RUN\",\"sec\":0}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"pump_run_sec\"}");
+  CHECK_EQ(deliver("{\"cmd\":\"SET\",\"soil_low\":80,\"soil_high\":20}", &cmd, &error), 0);
+  CHECK(error == "{\"cmd_error\":\"set_soil\"}");
+
+  // 未知指令照舊不回覆
+  CHECK_EQ(deliver("VALVE3_TOGGLE", &cmd, &error), 0);
+  CHECK(error.empty());
+
+  return checkResult("test_command");
+}
@@ -0,0 +1,138 @@
+// ==========================================
+//  FarmController 主機端測試：PUMP_RUN 與 pumpMaxRunTime 超時鎖定的邊界、
+//  感測快照過舊時 controlCycle() 停止自動澆水
+// ==========================================
+#include "v11.0.cpp"
+
+#include "check.h"
+#include "host.h"
+
+struct RunResult {
+  uint32_t runDoneMs;       // EV_PUMP_RUN_DONE 發生時距離開始的時間，0 = 沒發生
+  uint32_t timeoutMs;       // EV_PUMP_TIMEOUT
+  uint32_t runDone;         // 次數
+  uint32_t timeouts;
+  bool softAlarm;
+};
+
+// 手動模式、土壤濕度在上下限之間；接觸器回授跟著線圈，每 100 ms 一個週期
+static RunResult runPump(const FarmCmd& cmd, uint32_t seconds) {
+  FarmController c(controlDefaults);
+  const uint32_t start = 1000;
+  c.restore(false, false, -1, 0, 0, start);
+  c.command(cmd, start);
+
+  RunResult r = {};
+  bool coil = false;
+  for (uint32_t t = start; t <= start + seconds * 1000; t += 100) {
+    ControlInput in = {};
+    in.nowMs = t;
+    in.haveSensor = true;
+    in.rs485Ok = true;
+    in.soilHum = 50.0f;
+    in.pumpFeedback = coil;
+    ControlOutput out = c.tick(in);
+    coil = out.pump;
+    if (out.events & (1UL << EV_PUMP_RUN_DONE)) { r.runDone++; r.runDoneMs = t - start; }
+    if (out.events & (1UL << EV_PUMP_TIMEOUT)) { r.timeouts++; r.timeoutMs = t - start; }
+  }
+  r.softAlarm = c.pumpSoftAlarm();
+  return r;
+}
+
+// 跑 ms 毫秒的控制週期；接觸器回授跟著水泵輸出
+static void runCycles(uint32_t ms) {
+  for (uint32_t t = 0; t < ms; t += controlPeriodMs) {
+    hostClockAdvance(controlPeriodMs * 1000);
+    controlCycle(millis());
+    hostGpioDrive(fbPumpPin, hostGpioLevel(pumpPin) ? LOW : HIGH);
+  }
+}
+
+// 透過 MQTT 回調送出指令，回傳放進指令佇列的數量
+static int deliver(const char* payload, FarmCmd* cmd) {
+  char topic[] = "farm/control";
+  callback(topic, (byte*)payload, strlen(payload));
+  int n = 0;
+  while (xQueueReceive(cmdQueue, cmd, 0) == pdTRUE) n++;
+  return n;
+}
+
+int main() {
+  setup();
+  const uint32_t maxSec = pumpMaxRunTime * 60;
+
+  // 定時澆水剛好等於上限：正常結束，不算超時、不鎖定
+  FarmCmd run = { CMD_PUMP_RUN, (uint16_t)maxSec, 0 };
+  RunResult r = runPump(run, maxSec + 60);
+  CHECK_EQ(r.runDone, 1);
+  CHECK_EQ(r.runDoneMs, maxSec * 1000);
+  CHECK_EQ(r.timeouts, 0);
+  CHECK(!r.softAlarm);
+
+  // 比上限短：時間到就停
+  run.arg = 120;
+  r = runPump(run, maxSec + 60);
+  CHECK_EQ(r.runDone, 1);
+  CHECK_EQ(r.runDoneMs, 120000);
+  CHECK_EQ(r.timeouts, 0);
+  CHECK(!r.softAlarm);
+
+  // 手動開水泵不關：滿 pumpMaxRunTime 分鐘超時鎖定
+  FarmCmd on = { CMD_PUMP_ON, 0, 0 };
+  r = runPump(on, maxSec + 60);
+  CHECK_EQ(r.runDone, 0);
+  CHECK_EQ(r.timeouts, 1);
+  CHECK_EQ(r.timeoutMs, maxSec * 1000);
+  CHECK(r.softAlarm);
+
+  // 指令端的範圍：1 ~ pumpMaxRunTime * 60 秒
+  FarmCmd cmd = {};
+  char payload[64];
+  snprintf(payload, sizeof(payload), "{\"cmd\":\"PUMP_RUN\",\"sec\":%u}", (unsigned)maxSec);
+  CHECK_EQ(deliver(payload, &cmd), 1);
+  CHECK_EQ(cmd.type, CMD_PUMP_RUN);
+  CHECK_EQ(cmd.arg, maxSec);
+  snprintf(payload, sizeof(payload), "{\"cmd\":\"PUMP_RUN\",\"sec\":%u}", (unsigned)maxSec + 1);
+  CHECK_EQ(deliver(payload, &cmd), 0);
+  CHECK_EQ(deliver("{\"cmd\":\"PUMP_RUN\",\"sec\":0}", &cmd), 0);
+  CHECK_EQ(deliver("{\"cmd\":\"PUMP_RUN\",\"sec\":1}", &cmd), 1);
+  CHECK_EQ(cmd.arg, 1);
+
+  // 感測快照過舊：自動模式下土壤偏乾正在澆水，感測任務停止更新後要停水泵
+  farm.restore(true, false, -1, 0, 0, millis());
+  SensorSnapshot snap = {};
+  snap.soilHum = soilLow - 5;
+  snap.rs485Ok = true;
+  snap.dhtOk = true;
+  snap.takenMs = millis();
+  xQueueOverwrite(sensorMailbox, &snap);
+  runCycles(1000);
+  CHECK(farm.pumpRunning());
+  CHECK(farm.autoMode());
+
+  // 正常更新 (每個感測週期一筆) 時持續運轉
+  for (int k = 0; k < 6; k++) {
+    snap.takenMs = millis();
+    xQueueOverwrite(sensorMailbox, &snap);
+    runCycles(sensorPeriodMs);
+  }
+  CHECK(farm.pumpRunning());
+
+  // 停止更新：sensorStaleMs 之內照常，超過就停
+  snap.takenMs = millis();
+  xQueueOverwrite(sensorMailbox, &snap);
+  runCycles(sensorStaleMs - 100);
+  CHECK(farm.pumpRunning());
+  runCycles(200);
+  CHECK(!farm.pumpRunning());
+  CHECK(hostGpioLevel(pumpPin) == LOW);
+
+  // 感測任務恢復後照常自動澆水
+  snap.takenMs = millis();
+  xQueueOverwrite(sensorMailbox, &snap);
+  runCycles(1000);
+  CHECK(farm.pumpRunning());
+
+  return checkResult("test_control");
+}
@@ -0,0 +1,81 @@
+// ==========================================
+//  斷線暫存 (flash 環形日誌) 主機端測試：寫入失敗時暫存保留並重試、暫存滿時計入 dropped、
+//  farm/metrics 回報使用的分割區
+// ==========================================
+#include "v11.0.cpp"
+
+#include "check.h"
+#include "host.h"
+
+static FarmTelemetry sample(int i) {
+  FarmTelemetry t = {};
+  t.airTemp = 20.0f + i * 0.1f;
+  t.soilHum = 40.0f + i * 0.1f;
+  t.status = i;
+  return t;
+}
+
+// flash 上 seq 連續、CRC 正確的筆數 (從 slot 0 起)
+static uint32_t recordsOnFlash() {
+  const LogRecord* r = (const LogRecord*)hostFlash();
+  uint32_t n = 0;
+  while (n < flashLog.slots && logRecordValid(r[n]) && r[n].seq == n + 1) n++;
+  return n;
+}
+
+int main() {
+  setup();
+  FlashLog& L = flashLog;
+  CHECK(L.part != nullptr);
+  CHECK_EQ(L.pending, 0);
+
+  // 使用的分割區寫在 farm/metrics (預設不借用 spiffs)
+  CHECK_EQ(FLASH_LOG_USE_SPIFFS, 0);
+  client.hostConnected = true;
+  client.hostPublished.clear();
+  publishMetrics();
+  CHECK(!client.hostPublished.empty() && client.hostPublished[0].payload.find("\"log_part\":\"tlog\"") != std::string::npos);
+
+  // 正常：暫存滿 FLASH_LOG_STAGE 筆一次寫入
+  int i = 0;
+  for (; i < FLASH_LOG_STAGE; i++) flashLogAppend(sample(i), 1700000000 + i);
+  CHECK_EQ(L.staged, 0);
+  CHECK_EQ(L.pending, FLASH_LOG_STAGE);
+  CHECK_EQ(recordsOnFlash(), FLASH_LOG_STAGE);
+
+  // 寫入失敗：整批留在暫存，不算 written 也不算 dropped
+  hostFlashFailWrites = 1;
+  for (int k = 0; k < FLASH_LOG_STAGE; k++, i++) flashLogAppend(sample(i), 1700000000 + i);
+  CHECK_EQ(L.stats.writeErrors, 1);
+  CHECK_EQ(L.staged, FLASH_LOG_STAGE);
+  CHECK_EQ(L.stats.written, FLASH_LOG_STAGE);
+  CHECK_EQ(L.stats.dropped, 0);
+  CHECK(L.writeFailed);
+
+  // 下一筆進來時暫存已滿：丟掉最舊的一筆並計入 dropped，其餘重試成功
+  flashLogAppend(sample(i), 1700000000 + i);
+  i++;
+  CHECK_EQ(L.stats.dropped, 1);
+  CHECK_EQ(L.staged, 0);
+  CHECK(!L.writeFailed);
+  CHECK_EQ(L.stats.written, 2 * FLASH_LOG_STAGE);
+  CHECK_EQ(L.pending, 2 * FLASH_LOG_STAGE);
+  // 被丟掉的是 seq 9，flash 上 1~8 之後接著 10~17
+  const LogRecord* r = (const LogRecord*)hostFlash();
+  CHECK_EQ(recordsOnFlash(), FLASH_LOG_STAGE);
+  CHECK_EQ(r[FLASH_LOG_STAGE].seq, FLASH_LOG_STAGE + 2);
+  CHECK_EQ(r[2 * FLASH_LOG_STAGE - 1].seq, 2 * FLASH_LOG_STAGE + 1);
+
+  // 部分暫存時寫入失敗，之後的 flush 全部寫入
+  for (int k = 0; k < 3; k++, i++) flashLogAppend(sample(i), 1700000000 + i);
+  hostFlashFailWrites = 1;
+  flashLogFlush();
+  CHECK_EQ(L.stats.writeErrors, 2);
+  CHECK_EQ(L.staged, 3);
+  flashLogFlush();
+  CHECK_EQ(L.staged, 0);
+  CHECK_EQ(L.pending, 2 * FLASH_LOG_STAGE + 3);
+  CHECK_EQ(L.stats.dropped, 1);
+
+  return checkResult("test_flashlog");
+}
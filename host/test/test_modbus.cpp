@@ -0,0 +1,154 @@
+// ==========================================
+//  ModbusMaster 主機端測試：以模擬 UART 當從站，驗證
+//  正常回應、CRC 錯誤、短訊框、例外回應、位址錯誤、逾時、忙碌時拒絕與每筆交易延遲
+// ==========================================
+#include "v11.0.cpp"
+
+#include "check.h"
+#include "host.h"
+
+enum SlaveMode : uint8_t { SLAVE_OK, SLAVE_BAD_CRC, SLAVE_SHORT, SLAVE_EXCEPTION, SLAVE_WRONG_ADDR, SLAVE_SILENT };
+
+static SlaveMode slaveMode = SLAVE_OK;
+static const uint32_t slaveDelayUs = 3000;   // 從站收完請求後多久開始回應
+static uint32_t slaveRequests = 0;
+
+static void sealFrame(uint8_t* f, size_t n) {
+  uint16_t crc = modbusCrc16(f, n);
+  f[n] = crc & 0xFF;
+  f[n + 1] = crc >> 8;
+}
+
+// 模擬的從站：只回應 0x03 讀取保持暫存器 (廣播不回應)，數值 = 0x0100 + 暫存器位址
+static void slavePeer(HardwareSerial& port, const uint8_t* req, size_t len) {
+  slaveRequests++;
+  if (slaveMode == SLAVE_SILENT || len != 8 || req[0] == 0 || modbusCrc16(req, 6) != (req[6] | (req[7] << 8))) return;
+  uint16_t start = (req[2] << 8) | req[3];
+  uint16_t count = (req[4] << 8) | req[5];
+  uint8_t reply[MB_MAX_FRAME];
+
+  if (slaveMode == SLAVE_EXCEPTION) {
+    reply[0] = req[0];
+    reply[1] = req[1] | 0x80;
+    reply[2] = 0x02;                     // 非法資料位址
+    sealFrame(reply, 3);
+    port.hostReply(reply, 5, slaveDelayUs);
+    return;
+  }
+
+  reply[0] = slaveMode == SLAVE_WRONG_ADDR ? req[0] + 1 : req[0];
+  reply[1] = 0x03;
+  reply[2] = 2 * count;
+  for (uint16_t i = 0; i < count; i++) {
+    reply[3 + 2 * i] = 0x01;
+    reply[4 + 2 * i] = (start + i) & 0xFF;
+  }
+  size_t n = 3 + 2 * count;
+  sealFrame(reply, n);
+  if (slaveMode == SLAVE_BAD_CRC) reply[n + 1] ^= 0x5A;
+  port.hostReply(reply, slaveMode == SLAVE_SHORT ? n : n + 2, slaveDelayUs);
+}
+
+// 與韌體相同的接法：UART 的 RX 逾時回調標記訊框結束
+HardwareSerial testUart(1);
+ModbusMaster bus(testUart, -1, 9600, 200);
+
+static void testUartGap() { bus.onFrameGap(); }
+
+// 推進虛擬時鐘直到交易完成 (每 100 µs 呼叫一次 poll)，回傳結果
+static MbResult runTransaction(const uint8_t* frame, size_t len) {
+  CHECK(bus.begin(frame, len));
+  for (int i = 0; i < 100000 && !bus.done(); i++) {
+    hostClockAdvance(100);
+    bus.poll();
+  }
+  CHECK(bus.done());
+  return bus.finish();
+}
+
+int main() {
+  testUart.begin(9600);
+  testUart.setRxTimeout(4);
+  testUart.onReceive(testUartGap, true);
+  testUart.hostSetPeer(slavePeer);
+
+  constexpr MbFrame<8> query = mbReadFrame<0x01, 0x03, 0x0010, 4>();
+  const uint32_t charUs = testUart.hostCharUs();
+  const size_t replyLen = 5 + 2 * 4;
+
+  // 正常回應：內容、長度、延遲 = 請求傳送 + 從站延遲 + 回應傳送
+  slaveMode = SLAVE_OK;
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_OK);
+  CHECK_EQ(bus.replyLength(), replyLen);
+  CHECK_EQ(bus.reply()[2], 8);
+  CHECK_EQ(bus.reply()[3], 0x01);
+  CHECK_EQ(bus.reply()[4], 0x10);
+  CHECK_EQ(bus.reply()[10], 0x13);
+  uint32_t wireUs = (query.size + replyLen) * charUs + slaveDelayUs;
+  CHECK(bus.latencyUs() >= wireUs);
+  CHECK(bus.latencyUs() <= wireUs + 500);
+  CHECK_EQ(bus.stats.ok, 1);
+
+  // 忙碌中不能再送；begin() 立即返回，請求已經整筆寫到 UART
+  testUart.hostTx.clear();
+  CHECK(bus.begin(query.data(), query.size));
+  CHECK_EQ(testUart.hostTx.size(), query.size);
+  CHECK(!bus.begin(query.data(), query.size));
+  while (!bus.done()) { hostClockAdvance(100); bus.poll(); }
+  CHECK_EQ(bus.finish(), MB_OK);
+
+  // 送完之後要等 3.5 字元才算 ready
+  CHECK(!bus.ready());
+  hostClockAdvance(charUs * 4);
+  CHECK(bus.ready());
+
+  // CRC 錯誤
+  slaveMode = SLAVE_BAD_CRC;
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_CRC_ERROR);
+  CHECK_EQ(bus.stats.crcErrors, 1);
+
+  // 短訊框：少了 CRC 兩個位元組，靠 RX 逾時回調 (或字元間隔) 判斷結尾
+  slaveMode = SLAVE_SHORT;
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_SHORT_FRAME);
+  CHECK_EQ(bus.replyLength(), replyLen - 2);
+  CHECK_EQ(bus.stats.shortFrames, 1);
+
+  // 例外回應：不等正常長度，收到 5 個位元組就結束
+  slaveMode = SLAVE_EXCEPTION;
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_EXCEPTION);
+  CHECK_EQ(bus.exceptionCode(), 0x02);
+  CHECK_EQ(bus.replyLength(), 5);
+  CHECK_EQ(bus.stats.exceptions, 1);
+
+  // 位址不符
+  slaveMode = SLAVE_WRONG_ADDR;
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_BAD_REPLY);
+  CHECK_EQ(bus.stats.badReplies, 1);
+
+  // 沒有回應：逾時 200 ms
+  slaveMode = SLAVE_SILENT;
+  uint64_t t0 = hostClockUs();
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_TIMEOUT);
+  CHECK(hostClockUs() - t0 >= 200000);
+  CHECK(hostClockUs() - t0 <= 201000);
+  CHECK_EQ(bus.stats.timeouts, 1);
+
+  // 上一筆逾時後晚到的殘留位元組，下一筆 begin() 會先丟掉
+  slaveMode = SLAVE_OK;
+  const uint8_t junk[] = { 0x55, 0xAA, 0x55 };
+  testUart.hostInject(junk, sizeof(junk));
+  hostClockAdvance(charUs * 4);
+  CHECK_EQ(runTransaction(query.data(), query.size), MB_OK);
+  CHECK_EQ(bus.reply()[0], 0x01);
+
+  // 廣播 (位址 0) 不等回應
+  uint8_t broadcast[8];
+  mbBuildRead(broadcast, 0x00, 0x03, 0x0000, 1);
+  uint32_t before = slaveRequests;
+  CHECK_EQ(runTransaction(broadcast, sizeof(broadcast)), MB_OK);
+  CHECK_EQ(slaveRequests, before + 1);
+  CHECK_EQ(bus.replyLength(), 0);
+
+  CHECK_EQ(bus.stats.ok, 4);
+  return checkResult("test_modbus");
+}